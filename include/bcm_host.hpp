@@ -42,7 +42,7 @@ static_assert(sizeof(dma_channel_t) == 0x100);
  *	@for: Extended PWM
  *
  */
-struct __attribute__((packed)) dma_base_t
+struct dma_base_t
 {
     _RW dma_channel_t channel[15];
     _RS  uint32_t RESERVED_0[56];
@@ -51,6 +51,24 @@ struct __attribute__((packed)) dma_base_t
     _RW uint32_t ENABLE;
 };
 
+/**
+ *	Direct memory access control block
+ *
+ *	Read by the channel from bus addressable memory, 32 byte aligned. The channel loads it
+ *	into its registers when it starts on it and follows nextCB once done, 0 stops.
+ */
+struct alignas(32) dma_cb_t
+{
+    uint32_t transferInformation;
+    uint32_t sourceAddress;
+    uint32_t destinationAddress;
+    uint32_t transferLength;
+    uint32_t d2Stride;
+    uint32_t nextCB;
+    uint32_t RESERVED_0[2];
+};
+static_assert(sizeof(dma_cb_t) == 32);
+
 /**
  *	Power management block
  *
@@ -321,6 +339,9 @@ static_assert(offsetof(pwm_base_t, CTL) == 0x0);
 static_assert(offsetof(pwm_base_t, CHANNEL[0].RNG) == sizeof(uint32_t) * 4);
 static_assert(offsetof(pwm_base_t, CHANNEL[1].RNG) == sizeof(uint32_t) * 8);
 
+static_assert(offsetof(dma_base_t, INT_STATUS) == 0xfe0);
+static_assert(offsetof(dma_base_t, ENABLE) == 0xff0);
+
 #define CLK_CTL_BUSY    (1 <<7)
 #define CLK_CTL_KILL    (1 <<5)
 #define CLK_CTL_ENAB    (1 <<4)
@@ -330,14 +351,120 @@ static_assert(offsetof(pwm_base_t, CHANNEL[1].RNG) == sizeof(uint32_t) * 8);
 #define CLK_DIV_DIVF(x) ((x)<< 0)
 
 #define PWM_CTL_MSEN1 (1<<7)
+#define PWM_CTL_CLRF1 (1<<6)
+#define PWM_CTL_USEF1 (1<<5)
+#define PWM_CTL_POLA1 (1<<4)
+#define PWM_CTL_MODE1 (1<<1)
 #define PWM_CTL_PWEN1 (1<<0)
 
-unsigned bcm_getPeripheralAddress();
+#define PWM_STA_GAPO1 (1<<4)
+#define PWM_STA_FULL1 (1<<0)
+
+#define PWM_DMAC_ENAB     (1u<<31)
+#define PWM_DMAC_PANIC(x) ((x)<<8)
+#define PWM_DMAC_DREQ(x)  ((x)<<0)
+
+#define DMA_CS_RESET        (1u<<31)
+#define DMA_CS_ABORT        (1<<30)
+#define DMA_CS_DISDEBUG     (1<<29)
+#define DMA_CS_WAIT_WRITES  (1<<28)
+#define DMA_CS_PANIC_PRIORITY(x) ((x)<<20)
+#define DMA_CS_PRIORITY(x)  ((x)<<16)
+#define DMA_CS_ERROR        (1<<8)
+#define DMA_CS_PAUSED       (1<<4)
+#define DMA_CS_INT          (1<<2)
+#define DMA_CS_END          (1<<1)
+#define DMA_CS_ACTIVE       (1<<0)
+
+#define DMA_TI_NO_WIDE_BURSTS (1<<26)
+#define DMA_TI_PERMAP(x)    ((x)<<16)
+#define DMA_TI_SRC_DREQ     (1<<10)
+#define DMA_TI_SRC_INC      (1<<8)
+#define DMA_TI_DEST_DREQ    (1<<6)
+#define DMA_TI_DEST_INC     (1<<4)
+#define DMA_TI_WAIT_RESP    (1<<3)
+#define DMA_TI_TDMODE       (1<<1)
+#define DMA_TI_INTEN        (1<<0)
+
+/**
+ *  Peripheral window backend
+ *
+ *  DevMem maps the real register blocks through /dev/mem, Simulated maps them from the
+ *  anonymous memory of a software SoC model (see bcm_sim.hpp), which lets the providers
+ *  run on any Linux host. Auto picks the backend named by the LLD_BACKEND environment
+ *  variable ("devmem" or "sim") and defaults to DevMem.
+ */
+enum class bcm_backend
+{
+    Auto,
+    DevMem,
+    Simulated
+};
+
+/* Must be called before the first register block gets mapped */
+void bcm_setBackend(bcm_backend backend);
+[[nodiscard]] bcm_backend bcm_getBackend();
+
+uint64_t bcm_getPeripheralAddress();
 unsigned bcm_getPeripheralSize();
 
-static constexpr std::size_t bcm_numPwmControllers = 1;
+/* Acknowledge latched GPIO events (GPEDS is write-1-to-clear) */
+void bcm_gpioClearEvents(std::size_t bank, uint32_t mask);
+
+/**
+ *  SoC behind the peripheral window
+ *
+ *  Told apart by the compatible strings of the device tree (the peripheral base address
+ *  without one), the simulated SoC models a BCM2711.
+ */
+enum class bcm_soc
+{
+    BCM2835,    /* BCM2835, BCM2836, BCM2837 */
+    BCM2711
+};
+
+[[nodiscard]] bcm_soc bcm_getSoc();
+
+/* PWM blocks of the running SoC, sized for the largest */
+static constexpr std::size_t bcm_maxPwmControllers = 2;
+[[nodiscard]] std::size_t bcm_numPwmControllers();
+
+/* Function select, controller and channel of a pin able to output PWM */
+struct bcm_pwm_route
+{
+    int alt;
+    std::size_t controller;
+    int channel;
+};
+
+/* Routing of the pin on the running SoC, false when it has no PWM function */
+bool bcm_pwmRoute(int pin, bcm_pwm_route* out);
+
+/**
+ *  Memory the DMA engines can address
+ *
+ *  Allocated and locked through the VideoCore mailbox (/dev/vcio) and mapped uncached through
+ *  /dev/mem, so neither side sees stale cache lines. On the simulated SoC it is carved from an
+ *  arena the model reads control blocks and data from.
+ */
+struct bcm_dma_memory
+{
+    uint8_t* virt;
+    uint32_t bus;       /* address of virt as the DMA engines see it */
+    std::size_t size;
+    uint32_t handle;    /* VideoCore allocation, 0 on the simulated SoC */
+};
+
+/* Page aligned and zeroed, false when there is no mailbox or /dev/mem to get it from */
+bool bcm_dmaAlloc(std::size_t size, bcm_dma_memory* out);
+void bcm_dmaFree(bcm_dma_memory* memory);
+
+/* Bus address of a register in a mapped block, what a control block targeting it holds */
+[[nodiscard]] uint32_t bcm_busAddress(volatile void const* reg);
 
 [[maybe_unused]] volatile dma_base_t* bcm_dmaPerip();
+/* Channel of the DMA block, 0 to 14 */
+[[maybe_unused]] volatile dma_channel_t* bcm_dmaChannel(int channel);
 [[maybe_unused]] volatile power_management_t* bcm_pmPerip();
 [[maybe_unused]] volatile clock_management_t* bcm_clkPerip();
 [[maybe_unused]] volatile gpio_base_t* bcm_gpioPerip();
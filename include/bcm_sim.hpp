@@ -0,0 +1,150 @@
+//
+// Simulated SoC peripheral window
+//
+
+#ifndef LIGHTNING_BCM_SIM_HPP
+#define LIGHTNING_BCM_SIM_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "bcm_host.hpp"
+
+/**
+ *  Software model of the BCM283x peripheral window
+ *
+ *  The register blocks live in a memfd of the same size as the real peripheral window, so
+ *  bcm.cpp maps them exactly like it maps /dev/mem. A model thread (or explicit calls to
+ *  step()) applies the side effects the hardware would:
+ *
+ *      GPIO   GPSET/GPCLR are folded into the output latch and GPLEV, input pins follow
+ *             driveInput() or their pull resistor, GPEDS latches edges and levels enabled
+ *             in GPREN/GPFEN/GPHEN/GPLEN/GPAREN/GPAFEN.
+ *      CM     CTL/DIV writes are only accepted with BCM_PASSWORD, BUSY follows ENAB, KILL
+ *             stops the generator.
+ *      PWM    STA reports the channel state of the enabled channels and the FIFO level.
+ *             The FIFO drains one word per RNG cycles of the PWM clock of each channel
+ *             taking its data from it, paced by the wall clock between ticks. Only words
+ *             written by the DMA model are seen, CPU writes to FIF are not.
+ *      DMA    Channels enabled in ENABLE and ACTIVE walk their control blocks. Transfers
+ *             with DEST_DREQ on the PWM DREQ (PERMAP 5 for PWM0, 1 for PWM1, with DMAC.ENAB
+ *             set) feed the FIFO as it drains, unpaced ones are copied at once. Clearing
+ *             ACTIVE pauses the channel (PAUSED) and RESET clears it. Control blocks and
+ *             data live in memory from allocate(), at bus addresses 0xC0000000 on, and
+ *             peripherals are addressed at 0x7E000000 as on the hardware.
+ *
+ *  The registers are plain memory, the model only sees what they hold when it ticks. A GPSET
+ *  and a GPCLR of the same pin landing in one tick are applied set then clear, whatever order
+ *  they were written in, so clear then set ends low where the hardware ends high. The level in
+ *  between is never seen either, a pulse within one tick raises no edge events. Keep a tick
+ *  between the writes (step(), or wait for ticks() to move) when the order matters.
+ *
+ *  Use bcm_setBackend(bcm_backend::Simulated) (or LLD_BACKEND=sim) to route the library
+ *  through the model and bcm_simulator() to stimulate it.
+ */
+class SimulatedSoc
+{
+public:
+    static constexpr unsigned peripheralSize = 0x01000000;
+    static constexpr int pinCount = 54;
+
+    SimulatedSoc();
+    ~SimulatedSoc();
+
+    SimulatedSoc(SimulatedSoc const&) = delete;
+    SimulatedSoc& operator=(SimulatedSoc const&) = delete;
+
+    /** File descriptor backing the peripheral window, offsets are relative to the SoC base */
+    [[nodiscard]] int fd() const noexcept { return _fd; }
+
+    /** Run the model on its own thread, sleeping @period between ticks (0 = yield only) */
+    void start(std::chrono::nanoseconds period = std::chrono::nanoseconds{0});
+    void stop();
+    [[nodiscard]] bool running() const noexcept { return _running; }
+
+    /** Apply one model tick */
+    void step();
+
+    /** Drive the external level of an input pin, takes effect on the next tick */
+    void driveInput(int pin, bool level);
+    [[nodiscard]] bool level(int pin) const;
+
+    /** Write-1-to-clear emulation for GPEDS, plain memory cannot do it on its own */
+    void clearEvents(std::size_t bank, uint32_t mask);
+
+    [[nodiscard]] uint64_t ticks() const noexcept { return _ticks; }
+
+    /** Bus addressable memory for the DMA model, zeroed. False when the arena is exhausted */
+    bool allocate(std::size_t size, bcm_dma_memory* out);
+    void release(bcm_dma_memory const& memory);
+
+    /** Words the PWM controller has taken from its FIFO */
+    [[nodiscard]] uint64_t pwmWords(std::size_t controller) const noexcept { return _pwmWords[controller]; }
+
+    static constexpr unsigned arenaSize = 0x00400000;
+    static constexpr uint32_t arenaBus = 0xC0000000;
+    static constexpr std::size_t pwmFifoDepth = 16;
+
+private:
+    struct clock_pair_t
+    {
+        std::size_t ctl, div;
+        uint32_t ctlValue, divValue;
+    };
+
+    template<typename Tp>
+    volatile Tp* block(unsigned offset) const
+    {
+        return reinterpret_cast<volatile Tp*>(_base + offset);
+    }
+
+    void stepGpio();
+    void stepClocks();
+    void stepDma();
+    void stepPwm();
+
+    /* Model memory behind a bus address, nullptr when nothing is there */
+    volatile uint32_t* busWord(uint32_t bus) const;
+    double pwmClock() const;
+    bool loadBlock(int channel);
+    std::size_t transfer(int channel, std::size_t words);
+    std::size_t feedFifo(std::size_t controller, std::size_t words);
+
+    int _fd;
+    uint8_t* _base;
+
+    std::thread _thread{};
+    std::atomic_bool _running{false};
+    std::atomic<uint64_t> _ticks{0};
+
+    /* Model state not visible through the registers */
+    std::atomic<uint64_t> _inputs{0}, _driven{0};
+    uint64_t _latch{0};
+    uint64_t _pullUp{0}, _pudClock{0};
+    uint64_t _level{0};
+    clock_pair_t _clocks[5];
+
+    uint8_t* _arena;
+    std::mutex _arenaLock;
+    std::map<uint32_t, uint32_t> _allocations;     /* offset, size */
+
+    bool _dmaLoaded[15]{};
+    bool _dmaRunning[15]{};
+    std::size_t _pwmFifo[2]{};
+    double _pwmDue[2]{};
+    std::atomic<uint64_t> _pwmWords[2]{};
+    std::chrono::steady_clock::time_point _lastTick{};
+};
+
+/**
+ *  Simulated SoC driving the peripheral window
+ *
+ *  @return model instance when the Simulated backend is selected, nullptr otherwise.
+ *  The model thread is started on first use.
+ */
+[[nodiscard]] SimulatedSoc* bcm_simulator();
+
+#endif //LIGHTNING_BCM_SIM_HPP
@@ -7,12 +7,12 @@ namespace Clocks
     enum class ClockSource
     {
         Disabled = 0,
-        /** 19.2 MHz oscillator clock. Unlikely to change. */
+        /** 19.2 MHz oscillator clock (54 MHz on the BCM2711). Unlikely to change. */
         Oscillator,
         PLLA = 4,
         /** Main CPU clock (default 1.2 GHz), changes with overclock settings */
         PLLC,
-        /** 500 MHz fixed clock. Unlikely to change */
+        /** 500 MHz fixed clock (750 MHz on the BCM2711). Unlikely to change */
         PLLD,
         /** 216 MHz HDMI auxiliary clock. */
         HDMIAuxiliary
@@ -35,6 +35,17 @@ namespace Clocks
 
         static void SetPCMClock(ClockSource source, int integerDiv, int fractDiv);
         static void SetPWMClock(ClockSource source, int integerDiv, int fractDiv);
+
+        /**
+         *  Rate of the PWM clock in Hz, 0 when it is not running
+         *
+         *  Worked out from the clock manager registers and the rate of the source on first use,
+         *  then cached. SetPWMClock keeps it up to date, changes made outside of the library
+         *  are not seen.
+         */
+        static double GetPWMClockFrequency();
+        /* Rate of a clock source in Hz, from debugfs when readable and nominal otherwise. Cached */
+        static double GetSourceFrequency(ClockSource source);
         static void SetGPIOClock(int index, ClockSource source, int integerdiv, int fractDiv);
     };
 };
\ No newline at end of file
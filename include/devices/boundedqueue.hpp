@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace Devices
+{
+
+/**
+ *  Preallocated multi producer, multi consumer queue
+ *
+ *  Every cell carries a sequence number telling whether it is free for the push or filled
+ *  for the pop of the current lap, so producers and consumers only contend on their own
+ *  index. push() and pop() never block or allocate, they fail when the queue is full or
+ *  empty.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+	/* Capacity is rounded up to a power of two */
+	explicit BoundedQueue(std::size_t capacity) :
+		_mask(roundUp(capacity) - 1), _cells(new cell_t[_mask + 1])
+	{
+		for (std::size_t i = 0; i <= _mask; ++i)
+		{
+			_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	BoundedQueue(BoundedQueue const&) = delete;
+	BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+	bool push(T const& value) noexcept
+	{
+		auto position = _tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			auto& cell = _cells[position & _mask];
+			const auto sequence = cell.sequence.load(std::memory_order_acquire);
+			const auto lap = static_cast<std::ptrdiff_t>(sequence - position);
+
+			if (lap == 0 && _tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				cell.value = value;
+				cell.sequence.store(position + 1, std::memory_order_release);
+				return true;
+			}
+			if (lap < 0)
+			{
+				return false;
+			}
+			if (lap > 0)
+			{
+				position = _tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool pop(T& value) noexcept
+	{
+		auto position = _head.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			auto& cell = _cells[position & _mask];
+			const auto sequence = cell.sequence.load(std::memory_order_acquire);
+			const auto lap = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+
+			if (lap == 0 && _head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				value = cell.value;
+				cell.sequence.store(position + _mask + 1, std::memory_order_release);
+				return true;
+			}
+			if (lap < 0)
+			{
+				return false;
+			}
+			if (lap > 0)
+			{
+				position = _head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	[[nodiscard]] std::size_t capacity() const noexcept { return _mask + 1; }
+
+private:
+	struct cell_t
+	{
+		std::atomic<std::size_t> sequence;
+		T value;
+	};
+
+	static std::size_t roundUp(std::size_t n) noexcept
+	{
+		std::size_t size = 1;
+		while (size < n)
+		{
+			size <<= 1;
+		}
+		return size;
+	}
+
+	const std::size_t _mask;
+	std::unique_ptr<cell_t[]> _cells;
+
+	alignas(64) std::atomic<std::size_t> _tail{0};
+	alignas(64) std::atomic<std::size_t> _head{0};
+};
+
+}
@@ -1,16 +1,28 @@
 #pragma once
 
 #include "providers/gpio/igpio.hpp"
+#include "devices/gpioeventring.hpp"
+#include <array>
+#include <chrono>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <vector>
 
 namespace Devices::Gpio
 {
 
+class CallbackStrand;
+class EdgeMailbox;
+
 class GpioPin
 {
 	friend class GpioController;
+	friend class QuadratureEncoder;
+	friend class PulseMeter;
 public:
+	~GpioPin();
+
 	[[nodiscard]] PinValue read() const;
 	void write(PinValue val);
 
@@ -18,13 +30,108 @@ public:
     void setDriveMode(PinDriveMode mode);
 
     void enableInterrupt(PinEdge edge, std::function<void(GpioPin*, PinEdge)> callback);
+
+    /* Debounce/glitch filter of the interrupt engine, applies to every consumer of the edges */
+    void setFilter(PinFilter const& filter);
+    [[nodiscard]] uint64_t suppressedEdges() const noexcept;
+
+    /**
+     *  Queue the edges of the pin, to be pulled with readEvents()
+     *
+     *  Works alongside a callback, both see the same edges. Events that do not fit the queue
+     *  are dropped and counted by lostEvents(). PinEdge::None stops queueing, the events
+     *  queued so far can still be read. readEvents() must be called from one thread at a time.
+     */
+    void enableEvents(PinEdge edge, std::size_t capacity = 256);
+    [[nodiscard]] std::size_t readEvents(GpioEvent* events, std::size_t count);
+    [[nodiscard]] uint64_t lostEvents() const noexcept;
+
+    /**
+     *  Pollable fd for the queued events, to put the pin into an external event loop
+     *
+     *  The fd is readable while events wait for readEvents(), which never blocks. Without a
+     *  callback or waiter on the pin, a provider with pollable lines (character device) hands
+     *  out the line itself and no library thread is involved; the pin then takes no callbacks
+     *  or waits. Otherwise it is an eventfd the interrupt engine signals. Requires
+     *  enableEvents() first.
+     *
+     *  setEventFd() makes a group of pins signal one eventfd owned by the caller, who resets
+     *  it before draining the pins with readEvents().
+     */
+    [[nodiscard]] int eventFd();
+    void setEventFd(int fd);
+
+    /**
+     *  Block until the next edge of the pin, or until the timeout expires
+     *
+     *  The caller is woken by the interrupt engine directly. The first wait for an edge arms
+     *  the pin for it, and it stays armed for later waits. Up to 8 threads may wait at once,
+     *  but never a callback running inline on the interrupt engine. Returns false on timeout.
+     */
+    [[nodiscard]] bool waitForEdge(PinEdge edge, std::chrono::nanoseconds timeout, GpioEvent* event = nullptr);
+
 	[[nodiscard]] int pinNumber() const noexcept;
 
 private:
-	explicit GpioPin(Devices::Gpio::Provider::IGpioPinProvider* impl) :
-		_provider(impl) { }
+	explicit GpioPin(Devices::Gpio::Provider::IGpioPinProvider* impl);
+
+	void rearm();
+	EdgeMailbox* prepareWait(PinEdge edge);
 
 	std::unique_ptr<Devices::Gpio::Provider::IGpioPinProvider> _provider;
+
+	/* Consumers of the edges, the provider's handler holds its own copy of both */
+	PinEdge _edge{PinEdge::None};
+	std::function<void(GpioPin*, PinEdge)> _callback;
+	std::shared_ptr<GpioEventRing> _events;
+	bool _queueing{false};
+	/* Set when callbacks run on the callback executor */
+	std::shared_ptr<CallbackStrand> _strand;
+	/* Threads blocked in waitForEdge()/waitAny(), the pin is armed for _waitEdge */
+	std::shared_ptr<EdgeMailbox> _mailbox;
+	PinEdge _waitEdge{PinEdge::None};
+	/* Serialises the consumer updates with rearm(), waiters arrive from any thread */
+	std::mutex _armLock;
+	/* Fd signalled for queued events, the provider's own one in direct mode */
+	int _eventFd{-1};
+	int _ownEventFd{-1};
+	bool _direct{false};
+};
+
+/**
+ *  Group of pins read and written as one value
+ *
+ *  Bit n of the port value maps to the n-th pin the port was opened with. A write turns
+ *  into at most one set and one clear store per register bank (and read()/toggle() into
+ *  one level load), so all pins of a bank change at the same instant.
+ */
+class GpioPort
+{
+	friend class GpioController;
+public:
+	[[nodiscard]] uint64_t read() const;
+	void write(uint64_t mask, uint64_t value);
+	void toggle(uint64_t mask);
+
+	void setDriveMode(PinDriveMode mode);
+
+	[[nodiscard]] std::size_t width() const noexcept;
+	[[nodiscard]] std::vector<int> pinNumbers() const;
+
+private:
+	GpioPort(Devices::Gpio::Provider::IGpioPortProvider* impl, std::vector<int> pins, int base);
+
+	uint64_t spread(uint64_t value) const noexcept;
+	uint64_t gather(uint64_t value) const noexcept;
+
+	std::unique_ptr<Devices::Gpio::Provider::IGpioPortProvider> _provider;
+	std::vector<int> _pins;
+
+	/* Port <-> controller bit translation, a shift when the pins are consecutive */
+	int _shift;
+	bool _consecutive;
+	std::vector<std::array<uint64_t, 256>> _lut;
+	std::vector<int> _offsets;
 };
 
 class GpioController
@@ -35,9 +142,15 @@ public:
 
     [[nodiscard]] std::shared_ptr<GpioPin> open(int pin);
     [[nodiscard]] bool tryOpen(int pin, std::shared_ptr<GpioPin>* out) noexcept;
+    [[nodiscard]] std::shared_ptr<GpioPort> openPort(std::vector<int> const& pins);
+
+    /* Block until an edge on any of the pins, see GpioPin::waitForEdge(). event->pin tells which */
+    [[nodiscard]] static bool waitAny(std::vector<std::shared_ptr<GpioPin>> const& pins, PinEdge edge,
+                                      std::chrono::nanoseconds timeout, GpioEvent* event = nullptr);
 
     [[nodiscard]] int count() const noexcept;
     [[nodiscard]] std::string name() const;
+    [[nodiscard]] bool isMemoryMapped() const noexcept;
 
 	static std::shared_ptr<GpioController> getDefault();
 
@@ -46,7 +159,8 @@ private:
 		_impl(std::move(impl)) {}
 
 	std::unique_ptr<Devices::Gpio::Provider::IGpioControllerProvider> _impl;
-	static std::map<int, std::weak_ptr<GpioPin>> access;
+	/* Owner (a GpioPin or a GpioPort) of every opened pin */
+	static std::map<int, std::weak_ptr<void>> access;
 };
 
 using ControllerList = std::vector<std::shared_ptr<GpioController>>;
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "providers/gpio/igpio.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unistd.h>
+
+namespace Devices::Gpio
+{
+
+/**
+ *  Preallocated single producer, single consumer queue of edge events
+ *
+ *  The producer is the interrupt engine thread of the provider, the consumer whoever reads
+ *  the events of the pin. Neither side ever blocks or allocates, when the queue is full the
+ *  new event is dropped and counted instead. With a notify fd set (an eventfd, typically),
+ *  the producer writes 1 to it whenever the consumer may have to come back for events.
+ */
+class GpioEventRing
+{
+public:
+	/* Capacity is rounded up to a power of two */
+	explicit GpioEventRing(std::size_t capacity) :
+		_slots(roundUp(capacity)), _mask(_slots.size() - 1)
+	{
+	}
+
+	GpioEventRing(GpioEventRing const&) = delete;
+	GpioEventRing& operator=(GpioEventRing const&) = delete;
+
+	/* Producer side */
+	bool push(GpioEvent const& event) noexcept
+	{
+		const auto head = _head.load(std::memory_order_relaxed);
+		if (head - _tailCache > _mask)
+		{
+			_tailCache = _tail.load(std::memory_order_acquire);
+			if (head - _tailCache > _mask)
+			{
+				_lost.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		_slots[head & _mask] = event;
+		_head.store(head + 1, std::memory_order_release);
+		signal();
+		return true;
+	}
+
+	/* Consumer side, returns the number of events copied to out */
+	std::size_t pop(GpioEvent* out, std::size_t count) noexcept
+	{
+		const bool notifying = _notifyFd.load(std::memory_order_relaxed) >= 0;
+		if (notifying)
+		{
+			/* An event pushed from now on either is seen below or signals again */
+			_signalled.store(false);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			_headCache = _head.load(std::memory_order_acquire);
+		}
+
+		const auto tail = _tail.load(std::memory_order_relaxed);
+		if (_headCache - tail < count)
+		{
+			_headCache = _head.load(std::memory_order_acquire);
+		}
+
+		const auto n = std::min<std::size_t>(count, _headCache - tail);
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			out[i] = _slots[(tail + i) & _mask];
+		}
+
+		_tail.store(tail + n, std::memory_order_release);
+
+		/* Level triggered, events left behind keep the fd readable */
+		if (notifying && _headCache != tail + n)
+		{
+			signal();
+		}
+		return n;
+	}
+
+	/* Any thread, -1 stops the notifications */
+	void setNotifyFd(int fd) noexcept { _notifyFd.store(fd); }
+
+	[[nodiscard]] std::size_t size() const noexcept
+	{
+		return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+	}
+	[[nodiscard]] std::size_t capacity() const noexcept { return _slots.size(); }
+	[[nodiscard]] uint64_t lost() const noexcept { return _lost.load(std::memory_order_relaxed); }
+
+private:
+	void signal() noexcept
+	{
+		if (const auto fd = _notifyFd.load(std::memory_order_relaxed); fd >= 0 && !_signalled.exchange(true))
+		{
+			const uint64_t one = 1;
+			[[maybe_unused]] auto written = ::write(fd, &one, sizeof one);
+		}
+	}
+
+	static std::size_t roundUp(std::size_t n) noexcept
+	{
+		std::size_t size = 1;
+		while (size < n)
+		{
+			size <<= 1;
+		}
+		return size;
+	}
+
+	std::vector<GpioEvent> _slots;
+	const std::size_t _mask;
+
+	/* Indices only grow, each side caches the other's to stay off its cache line */
+	alignas(64) std::atomic<std::size_t> _head{0};
+	std::size_t _tailCache{0};
+	alignas(64) std::atomic<std::size_t> _tail{0};
+	std::size_t _headCache{0};
+
+	alignas(64) std::atomic<uint64_t> _lost{0};
+	std::atomic<int> _notifyFd{-1};
+	std::atomic_bool _signalled{false};
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "devices/pwm.hpp"
+#include "devices/pwmstream.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Devices::Pwm
+{
+
+struct Rgb
+{
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+};
+
+/**
+ *  WS2812 (NeoPixel) class LED chain on a PWM channel in serializer mode
+ *
+ *  Three serializer bits per LED bit (100 for a zero, 110 for a one) at a 2.4MHz PWM clock
+ *  give the 800kHz timing, a lookup table turns every color byte into its 24 bit pattern.
+ *  Encoded frames are streamed into the FIFO by DMA (see PwmStream), the ring holds two of
+ *  them: show() encodes the next frame while the previous one is still shifting out, and
+ *  only waits when a third one would not fit.
+ *
+ *  The PWM clock is shared by every channel of both controllers, so the strip does not set
+ *  it. Call takeClock() first, knowing every other PWM output runs from 2.4MHz afterwards.
+ */
+class LedStrip
+{
+public:
+	/**
+	 *  Throws LLD::invalid_argument_exception unless the PWM clock runs within 5% of 2.4MHz,
+	 *  and LLD::not_supported_exception when dmaChannel cannot feed the FIFO: without DMA
+	 *  the frames do not keep up with 800kHz
+	 */
+	LedStrip(std::shared_ptr<PwmChannel> channel, std::size_t leds, int dmaChannel = PwmStream::defaultDmaChannel);
+	~LedStrip();
+
+	/* Sets the PWM clock of all controllers to 2.4MHz from the oscillator, returns the rate set */
+	static double takeClock();
+
+	LedStrip(LedStrip const&) = delete;
+	LedStrip& operator=(LedStrip const&) = delete;
+
+	/* Colors of the first count LEDs, the rest are turned off. Sent in GRB order */
+	void show(Rgb const* colors, std::size_t count);
+	/* Blocks until the frames shown so far have left the ring */
+	void flush();
+
+	[[nodiscard]] std::size_t size() const noexcept { return _leds; }
+	[[nodiscard]] uint64_t underruns() const noexcept { return _stream->underruns(); }
+
+	/* Frame followed by at least 300us low, the latch time of current WS2812B parts */
+	static constexpr std::size_t resetWords = 24;
+
+private:
+	std::size_t encode(Rgb const* colors, std::size_t count);
+
+	std::shared_ptr<PwmChannel> _channel;
+	const std::size_t _leds;
+	double _wordRate;
+	std::vector<uint32_t> _frame;
+	std::unique_ptr<PwmStream> _stream;
+};
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace Devices::Gpio
+{
+
+/**
+ *  Logic analyzer over the GPIO level registers
+ *
+ *  A library thread reads both GPLEV banks once per interval, spinning in between, and
+ *  stores only the changes of the selected pins. Each record is two varints: the samples
+ *  since the previous record and the pins that changed (levels XOR the previous levels),
+ *  so a quiet bus costs nothing and a busy one a few bytes per change. The buffer is
+ *  allocated and touched up front and the capture stops when it is full. Samples the thread
+ *  was too late for are skipped rather than shifted, record times stay multiples of the
+ *  interval. Requires a memory mapped controller, pins are read and need not be opened.
+ */
+class LogicCapture
+{
+public:
+	/* Bit n of pins selects pin n */
+	LogicCapture(uint64_t pins, std::chrono::nanoseconds interval, std::size_t bufferSize = 4 << 20);
+	~LogicCapture();
+
+	LogicCapture(LogicCapture const&) = delete;
+	LogicCapture& operator=(LogicCapture const&) = delete;
+
+	/* Starts a new capture, discarding the previous one. Returns once the first sample is taken */
+	void start();
+	void stop();
+
+	[[nodiscard]] bool running() const noexcept { return _running.load(std::memory_order_relaxed); }
+	/* The capture stopped on a full buffer */
+	[[nodiscard]] bool overflowed() const noexcept { return _overflowed.load(std::memory_order_relaxed); }
+	/* Sample slots covered, and how many of those were skipped */
+	[[nodiscard]] uint64_t samples() const noexcept { return _samples.load(std::memory_order_relaxed); }
+	[[nodiscard]] uint64_t missed() const noexcept { return _missed.load(std::memory_order_relaxed); }
+	/* Bytes of the buffer used */
+	[[nodiscard]] std::size_t size() const noexcept { return _used.load(std::memory_order_relaxed); }
+
+	/* Levels of the selected pins at the first sample and at every change, may run alongside the capture */
+	void forEach(std::function<void(std::chrono::nanoseconds time, uint64_t levels)> const& fn) const;
+
+	/* Value Change Dump of the capture, one wire per selected pin */
+	void writeVcd(std::ostream& out) const;
+
+private:
+	void run();
+	bool append(uint64_t samples, uint64_t changes) noexcept;
+
+	const uint64_t _pins;
+	const std::chrono::nanoseconds _interval;
+	std::vector<uint8_t> _buffer;
+
+	std::thread _thread;
+	std::atomic_bool _running{false};
+	std::atomic_bool _overflowed{false};
+	/* Written by the capture thread, records up to _used are complete */
+	std::atomic<std::size_t> _used{0};
+	std::atomic<uint64_t> _samples{0};
+	std::atomic<uint64_t> _missed{0};
+};
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "devices/gpio.hpp"
+#include "devices/boundedqueue.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Devices::Gpio
+{
+
+/* Outcome of a scheduled output change, times on std::chrono::steady_clock */
+struct OutputResult
+{
+	uint64_t id;
+	std::chrono::steady_clock::time_point requested;
+	std::chrono::steady_clock::time_point actual;
+
+	[[nodiscard]] std::chrono::nanoseconds lateness() const noexcept { return actual - requested; }
+};
+
+/**
+ *  Writes the pins of a GpioPort at absolute times
+ *
+ *  Commands are queued from any thread without a lock and carried out by a library thread,
+ *  which sleeps until shortly before the earliest one and spins the rest of the way. Commands
+ *  due at the same time go out with a single port write; a pin both set and cleared ends up
+ *  high. Each command executed leaves an OutputResult with the time of its write, to be
+ *  collected with readResults() by one thread at a time. Results that do not fit are dropped
+ *  and counted.
+ */
+class OutputScheduler
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	/* The port is switched to outputs, capacity bounds both the commands and the results waiting */
+	explicit OutputScheduler(std::shared_ptr<GpioPort> port, std::size_t capacity = 1024);
+	~OutputScheduler();
+
+	OutputScheduler(OutputScheduler const&) = delete;
+	OutputScheduler& operator=(OutputScheduler const&) = delete;
+
+	/* Masks in port bits. Returns the id of the command, or 0 when the queue is full */
+	uint64_t schedule(clock::time_point when, uint64_t set, uint64_t clear);
+
+	std::size_t readResults(OutputResult* results, std::size_t count);
+	[[nodiscard]] uint64_t droppedResults() const noexcept { return _droppedResults.load(std::memory_order_relaxed); }
+
+private:
+	struct command_t
+	{
+		uint64_t id;
+		uint64_t when;		/* ns */
+		uint64_t set;
+		uint64_t clear;
+	};
+
+	void run();
+	bool drain();
+	void wait(uint32_t posted, uint64_t until);
+
+	std::shared_ptr<GpioPort> _port;
+	BoundedQueue<command_t> _commands;
+	BoundedQueue<OutputResult> _results;
+	std::atomic<uint64_t> _nextId{1};
+	std::atomic<uint64_t> _droppedResults{0};
+
+	/* Thread only, sorted by time */
+	std::vector<command_t> _pending;
+
+	/* Futex word, bumped on every command so a sleeping thread never misses one */
+	std::atomic<uint32_t> _posted{0};
+	std::atomic_bool _sleeping{false};
+	std::atomic_bool _running{true};
+	std::thread _thread;
+};
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "devices/gpio.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Devices::Gpio
+{
+
+/* Statistics over the last pulses seen by a PulseMeter, all zero before the first one */
+struct PulseStats
+{
+	std::chrono::nanoseconds periodMin;
+	std::chrono::nanoseconds periodMax;
+	std::chrono::nanoseconds periodMean;
+	std::chrono::nanoseconds highMin;
+	std::chrono::nanoseconds highMax;
+	std::chrono::nanoseconds highMean;
+	std::size_t samples;
+	/* steady_clock time of the last edge, to tell a stopped signal from a slow one */
+	std::chrono::nanoseconds lastEdge;
+
+	[[nodiscard]] double frequency() const noexcept
+	{
+		return periodMean.count() ? 1e9 / periodMean.count() : 0.0;
+	}
+	[[nodiscard]] double dutyCycle() const noexcept
+	{
+		return periodMean.count() ? static_cast<double>(highMean.count()) / periodMean.count() : 0.0;
+	}
+};
+
+/**
+ *  Period and high time measurement of an input
+ *
+ *  Both edges are timestamped by the interrupt engine (at the poll that saw them with the DMA
+ *  provider, by the kernel with the character device one). Every rising edge closes a pulse,
+ *  the statistics cover the last window pulses. A pulse with a missing edge is dropped, which
+ *  happens when the signal is faster than the engine can follow.
+ *
+ *  stats() may be called from any thread and never blocks the engine, it retries while the
+ *  engine is updating. The meter takes over the interrupts of the pin while it exists.
+ */
+class PulseMeter
+{
+public:
+	explicit PulseMeter(std::shared_ptr<GpioPin> pin, std::size_t window = 64);
+	~PulseMeter();
+
+	PulseMeter(PulseMeter const&) = delete;
+	PulseMeter& operator=(PulseMeter const&) = delete;
+
+	[[nodiscard]] PulseStats stats() const noexcept;
+	[[nodiscard]] uint64_t dropped() const noexcept { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+	struct Window;
+
+	void edge(GpioEvent const& event);
+	void publish();
+
+	std::shared_ptr<GpioPin> _pin;
+	/* Interrupt engine only */
+	std::unique_ptr<Window> _window;
+
+	/* Seqlock, odd while the engine writes the published fields */
+	alignas(64) std::atomic<uint64_t> _sequence{0};
+	std::array<std::atomic<uint64_t>, 8> _published{};
+	std::atomic<uint64_t> _dropped{0};
+};
+
+}
@@ -1,14 +1,18 @@
 #pragma once
 #include "providers/pwm/ipwm.hpp"
+#include <array>
 #include <memory>
 #include <string>
 #include <map>
+#include <utility>
 
 namespace Devices::Pwm {
 
 class PwmChannel
 {
 	friend class PwmController;
+	friend class PwmStream;
+	friend class LedStrip;
 public:
 	void setRange(uint32_t range) NOEXCEPT;
 	[[nodiscard]] uint32_t getRange() const NOEXCEPT;
@@ -24,6 +28,24 @@ public:
 
     [[nodiscard]] int channel() const NOEXCEPT;
 
+	/**
+	 *  Period and duty cycle in physical units, on top of range and data
+	 *
+	 *  setFrequency() picks the range closest to the requested frequency at the current PWM
+	 *  clock and keeps the duty cycle, returns the frequency achieved. Throws
+	 *  invalid_argument_exception when it is out of reach of the clock, or the clock is not
+	 *  running yet (see Clocks::ClockManager::SetPWMClock()). Fractions outside
+	 *  [0, 1] are clamped. None of them touch the peripheral for reading.
+	 */
+	double setFrequency(double hz);
+	[[nodiscard]] double frequency() const NOEXCEPT;
+
+	void setDutyCycle(double fraction) NOEXCEPT;
+	[[nodiscard]] double dutyCycle() const NOEXCEPT;
+
+	/* Smallest duty cycle step at the current frequency, 1 / range */
+	[[nodiscard]] double resolution() const NOEXCEPT;
+
 private:
 	PwmChannel(Devices::Pwm::Provider::IPwmChannelProvider* impl)
 	    : _provider(impl)
@@ -33,6 +55,39 @@ private:
 	std::unique_ptr<Devices::Pwm::Provider::IPwmChannelProvider> _provider;
 };
 
+/**
+ *  Settings of the channels of a controller, applied together
+ *
+ *  The setters only stage, commit() writes whatever changed so all channels switch in the
+ *  same PWM period, paired outputs (H-bridges, complementary drives) never see a period of
+ *  mixed settings. Acts on the channels whether they are open or not and must not outlive
+ *  its controller.
+ */
+class PwmTransaction
+{
+	friend class PwmController;
+public:
+	static constexpr int maxChannels = 2;
+
+	PwmTransaction& setRange(int channel, uint32_t range);
+	PwmTransaction& setData(int channel, uint32_t data);
+	PwmTransaction& setPolarity(int channel, Polarity polarity);
+	PwmTransaction& enable(int channel, bool enable);
+
+	/* Throws not_supported_exception when the controller cannot commit atomically. Nothing
+	 * stays staged afterwards, the transaction can be reused */
+	void commit();
+
+private:
+	explicit PwmTransaction(Devices::Pwm::Provider::IPwmControllerProvider* controller) :
+		_controller(controller) {}
+
+	Devices::Pwm::Provider::PwmChannelUpdate& staged(int channel, const char* fn);
+
+	Devices::Pwm::Provider::IPwmControllerProvider* _controller;
+	std::array<Devices::Pwm::Provider::PwmChannelUpdate, maxChannels> _updates{};
+};
+
 class PwmController
 {
 	friend class PwmProvider;
@@ -43,6 +98,8 @@ public:
     [[nodiscard]] std::string name() const;
     [[nodiscard]] int count() const noexcept;
 
+	[[nodiscard]] PwmTransaction transaction() noexcept;
+
 	static std::shared_ptr<PwmController> getDefault();
 
 private:
@@ -50,7 +107,8 @@ private:
 		_provider(std::move(impl)) {}
 
 	std::unique_ptr<Devices::Pwm::Provider::IPwmControllerProvider> _provider;
-    static std::map<int, std::weak_ptr<PwmChannel>> access;
+    /* Open channels by controller name and channel */
+    static std::map<std::pair<std::string, int>, std::weak_ptr<PwmChannel>> access;
 };
 
 using ControllerList = std::vector<std::shared_ptr<PwmController>>;
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "devices/pwm.hpp"
+#include "bcm_host.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Devices::Pwm
+{
+
+/**
+ *  Continuous playback of duty cycle samples through the FIFO of a PWM channel
+ *
+ *  The application queues samples (data values, within the range of the channel) into a
+ *  ring, with write() or from a refill callback. The channel plays one sample per PWM cycle,
+ *  sampleRate has to match (PWM clock / range).
+ *
+ *  The ring lives in DMA memory (see bcm_dmaAlloc) cut into segments of segmentLength
+ *  samples, each with a control block moving it into the FIFO. A DMA channel paced by the PWM
+ *  DREQ plays them without the CPU: write() links every segment it completes behind the last
+ *  one, the DMA stops at the end of the chain and the next completed segment restarts it. A
+ *  partial segment waits for the rest of its samples, pad the end of a stream. The refill
+ *  callback runs on a library thread, started by the first setRefill().
+ *
+ *  Without DMA (no mailbox or /dev/mem, or a negative dmaChannel) a library thread tops up
+ *  the FIFO from the ring instead, once per half FIFO worth of samples and never more than
+ *  the channel can have consumed by then. It only keeps up with low sample rates.
+ *
+ *  Underruns count the times the FIFO ran dry while playing: the DMA reaching the end of
+ *  the chain, or the hardware or the thread noticing it without DMA.
+ */
+class PwmStream
+{
+public:
+	/* Refill callback, fills up to count samples and returns how many it did. Runs on the library thread */
+	using Refill = std::function<std::size_t(uint32_t* samples, std::size_t count)>;
+
+	/* Puts the channel into FIFO mode and enables it, capacity is rounded up to a power of two */
+	PwmStream(std::shared_ptr<PwmChannel> channel, double sampleRate, std::size_t capacity = 4096,
+			  int dmaChannel = defaultDmaChannel);
+	/* Stops the DMA and the thread, the channel goes back to DAT and stays enabled */
+	~PwmStream();
+
+	PwmStream(PwmStream const&) = delete;
+	PwmStream& operator=(PwmStream const&) = delete;
+
+	/* One producer thread at a time. Never blocks, returns how many samples fitted */
+	std::size_t write(uint32_t const* samples, std::size_t count);
+	/* Asked whenever the ring is less than half full, nullptr stops asking */
+	void setRefill(Refill refill);
+
+	/* Samples queued and not yet handed to the FIFO, to the segment with DMA */
+	[[nodiscard]] std::size_t queued() const noexcept;
+	[[nodiscard]] std::size_t capacity() const noexcept { return _capacity; }
+	/* Samples handed to the FIFO */
+	[[nodiscard]] uint64_t played() const noexcept;
+	[[nodiscard]] uint64_t underruns() const noexcept;
+	/* Whether a DMA channel feeds the FIFO, false when the thread does */
+	[[nodiscard]] bool dma() const noexcept { return _dmaRegs != nullptr; }
+
+	/* Hardware FIFO depth in samples */
+	static constexpr std::size_t fifoDepth = 16;
+	/* Samples per control block, the unit the DMA is handed the ring in */
+	static constexpr std::size_t segmentLength = 64;
+	/* Pick another channel where something else drives this one */
+	static constexpr int defaultDmaChannel = 10;
+
+private:
+	void run();
+	void runRefill();
+	void refill();
+	std::size_t push(uint32_t const* samples, std::size_t count) noexcept;
+
+	bool startDma(int channel);
+	void stopDma();
+	void link(std::size_t segment) noexcept;
+	[[nodiscard]] std::size_t dmaTail() const noexcept;
+
+	std::shared_ptr<PwmChannel> _channel;
+	const double _sampleRate;
+
+	/* Single producer (write() or the refill callback), single consumer (the thread or the DMA) */
+	const std::size_t _capacity;
+	const std::size_t _mask;
+	uint32_t* _samples{nullptr};
+	std::vector<uint32_t> _ring;
+	alignas(64) std::atomic<std::size_t> _head{0};
+	alignas(64) std::atomic<std::size_t> _tail{0};
+
+	/* Control blocks followed by the ring, a block per segment */
+	bcm_dma_memory _dma{};
+	volatile dma_channel_t* _dmaRegs{nullptr};
+	dma_cb_t* _blocks{nullptr};
+	std::size_t _segments{0};
+	/* Samples linked into the chain, whole segments */
+	std::atomic<std::size_t> _published{0};
+	std::atomic_bool _started{false};
+
+	std::mutex _refillLock;
+	Refill _refill;
+	std::vector<uint32_t> _scratch;
+
+	std::atomic<uint64_t> _played{0};
+	std::atomic<uint64_t> _underruns{0};
+
+	std::atomic_bool _running{true};
+	std::thread _thread;
+};
+
+}
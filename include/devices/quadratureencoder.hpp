@@ -0,0 +1,63 @@
+#pragma once
+
+#include "devices/gpio.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace Devices::Gpio
+{
+
+/**
+ *  Incremental (A/B quadrature) encoder, decoded by the interrupt engine
+ *
+ *  Every edge of either channel counts (x4 decoding). With a memory mapped controller both
+ *  channels come from the single level read of the poll that saw the edge, otherwise they
+ *  are tracked from the edges the provider reports. A transition where both channels changed
+ *  at once cannot be decoded, it is counted as an error and the position may be off by two.
+ *
+ *  Position and velocity are plain atomics, read from any thread without a lock. The encoder
+ *  takes over the interrupts of both pins while it exists, they have to belong to the same
+ *  controller.
+ */
+class QuadratureEncoder
+{
+public:
+	/* Velocity is averaged over window, while the shaft turns */
+	QuadratureEncoder(std::shared_ptr<GpioPin> a, std::shared_ptr<GpioPin> b,
+					  std::chrono::microseconds window = std::chrono::milliseconds{10});
+	~QuadratureEncoder();
+
+	QuadratureEncoder(QuadratureEncoder const&) = delete;
+	QuadratureEncoder& operator=(QuadratureEncoder const&) = delete;
+
+	/* Counts, increasing while A leads B */
+	[[nodiscard]] int64_t position() const noexcept { return _position.load(std::memory_order_relaxed); }
+	void setPosition(int64_t position) noexcept { _position.store(position, std::memory_order_relaxed); }
+
+	/* Counts per second. Once the edges stop, it decays as if the next one was about to come */
+	[[nodiscard]] double velocity() const noexcept;
+
+	[[nodiscard]] uint64_t errors() const noexcept { return _errors.load(std::memory_order_relaxed); }
+
+private:
+	void update(unsigned state, uint64_t timestamp);
+
+	std::shared_ptr<GpioPin> _a, _b;
+	const uint64_t _window;		/* ns */
+
+	/* Interrupt engine only. State is A << 1 | B, counts ignore setPosition() */
+	unsigned _state;
+	int64_t _counts{0};
+	int64_t _windowCounts{0};
+	uint64_t _windowStart{0};
+	uint64_t _lastEdge{0};
+
+	alignas(64) std::atomic<int64_t> _position{0};
+	std::atomic<double> _velocity{0.0};
+	std::atomic<uint64_t> _lastEdgeSeen{0};
+	std::atomic<uint64_t> _errors{0};
+};
+
+}
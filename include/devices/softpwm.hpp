@@ -0,0 +1,90 @@
+#pragma once
+
+#include "devices/gpio.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Devices::Gpio
+{
+
+/**
+ *  Software PWM on the pins of a GpioPort, channel n being bit n of the port
+ *
+ *  One library thread keeps the next edge of every channel in a schedule sorted by time. It
+ *  sleeps until shortly before the earliest edge, spins up to it, then takes every edge due
+ *  within the resolution and applies them with a single port write, so channels switching
+ *  together cost one set and one clear store per bank. New settings of a channel take effect
+ *  at the start of its next period, a period never mixes old and new ones.
+ *
+ *  The settings of a channel are a single atomic word and the thread is woken through a futex,
+ *  it never takes a lock. Jitter depends on the scheduling of the thread (see ThreadPolicy),
+ *  lateEdges() counts the edges applied later than the resolution allows.
+ */
+class SoftPwm
+{
+public:
+	static constexpr std::size_t maxChannels = 64;
+
+	/* The port is switched to outputs, driven low */
+	explicit SoftPwm(std::shared_ptr<GpioPort> port,
+					 std::chrono::nanoseconds resolution = std::chrono::microseconds{2});
+	~SoftPwm();
+
+	SoftPwm(SoftPwm const&) = delete;
+	SoftPwm& operator=(SoftPwm const&) = delete;
+
+	/* Period up to 4.29s, a zero period turns the channel off (low) */
+	void setPulse(std::size_t channel, std::chrono::nanoseconds period, std::chrono::nanoseconds high);
+	/* Duty cycle within 0-1, a zero frequency turns the channel off */
+	void set(std::size_t channel, double frequency, double dutyCycle);
+
+	[[nodiscard]] std::size_t channels() const noexcept { return _channels.size(); }
+	[[nodiscard]] uint64_t lateEdges() const noexcept { return _late.load(std::memory_order_relaxed); }
+
+private:
+	struct channel_t
+	{
+		uint64_t start{0};		/* ns, rising edge of the current period */
+		uint32_t period{0};		/* ns, 0 while off */
+		uint32_t high{0};
+		bool rising{true};		/* next edge starts a period */
+	};
+
+	struct edge_t
+	{
+		uint64_t time;			/* ns */
+		std::size_t channel;
+	};
+
+	void run();
+	void wait(uint32_t posted, uint64_t until);
+	void schedule(std::size_t channel, uint64_t time);
+	void edge(std::size_t channel, uint64_t time, uint64_t now, uint64_t& value);
+
+	std::shared_ptr<GpioPort> _port;
+	const uint64_t _resolution;		/* ns */
+
+	/* Period << 32 | high time, in ns, picked up by the thread at period boundaries */
+	std::array<std::atomic<uint64_t>, maxChannels> _settings{};
+
+	/* Thread only */
+	std::vector<channel_t> _channels;
+	std::vector<edge_t> _schedule;
+	std::vector<edge_t> _batch;
+
+	std::atomic<uint64_t> _late{0};
+
+	/* Futex word, bumped when a channel is turned on and to stop the thread */
+	std::atomic<uint32_t> _posted{0};
+	std::atomic_bool _sleeping{false};
+	std::atomic_bool _running{true};
+	std::thread _thread;
+};
+
+}
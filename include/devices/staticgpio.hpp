@@ -0,0 +1,102 @@
+#pragma once
+
+#include "devices/gpio.hpp"
+#include "bcm_host.hpp"
+#include "exceptions.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace Devices::Gpio
+{
+
+/* The SoC as bcm_getSoc() reports it */
+using Soc = bcm_soc;
+
+/* The BCM2711 has 58 GPIOs, the providers and their register banks cover the 54 both share */
+template<Soc soc> struct SocTraits;
+template<> struct SocTraits<Soc::BCM2835> { static constexpr int pinCount = 54; };
+template<> struct SocTraits<Soc::BCM2711> { static constexpr int pinCount = 54; };
+
+/* Register base shared by every StaticGpioPin, resolved when the first one is opened */
+class StaticGpioRegisters
+{
+protected:
+	static volatile gpio_base_t* regs() noexcept { return _regs.load(std::memory_order_relaxed); }
+	static void resolve() { _regs.store(bcm_gpioPerip(), std::memory_order_relaxed); }
+
+private:
+	static inline std::atomic<volatile gpio_base_t*> _regs{nullptr};
+};
+
+/**
+ *  GPIO pin with compile time register layout
+ *
+ *  Bank, mask and function select position are constants and read/write/toggle are inline
+ *  register accesses without any virtual dispatch. The pin is still opened through the
+ *  controller, so it is accounted for like any other GpioPin (and drive mode changes go
+ *  through it). Requires a memory mapped controller, see GpioController::isMemoryMapped(),
+ *  and the SoC it was built for, see bcm_getSoc().
+ */
+template<int Pin, Soc soc = Soc::BCM2835>
+class StaticGpioPin : StaticGpioRegisters
+{
+	static_assert(Pin >= 0 && Pin < SocTraits<soc>::pinCount, "Pin is not available on this SoC");
+
+public:
+	static constexpr int bank = Pin / 32;
+	static constexpr uint32_t mask = uint32_t{1} << (Pin % 32);
+	static constexpr int fselBank = Pin / 10;
+	static constexpr int fselShift = 3 * (Pin % 10);
+
+	explicit StaticGpioPin(GpioController& controller)
+	{
+		if (!controller.isMemoryMapped() || soc != bcm_getSoc())
+		{
+			throw LLD::not_supported_exception{};
+		}
+
+		_pin = controller.open(Pin);
+		if (!regs())
+		{
+			resolve();
+		}
+	}
+
+	[[nodiscard]] PinValue read() const noexcept
+	{
+		return (regs()->GPLEV[bank] & mask) ? PinValue::High : PinValue::Low;
+	}
+	void write(PinValue val) noexcept
+	{
+		if (val == PinValue::High)
+		{
+			regs()->GPSET[bank] = mask;
+		}
+		else
+		{
+			regs()->GPCLR[bank] = mask;
+		}
+	}
+	void toggle() noexcept
+	{
+		if (regs()->GPLEV[bank] & mask)
+		{
+			regs()->GPCLR[bank] = mask;
+		}
+		else
+		{
+			regs()->GPSET[bank] = mask;
+		}
+	}
+
+	[[nodiscard]] PinDriveMode getDriveMode() const { return _pin->getDriveMode(); }
+	void setDriveMode(PinDriveMode mode) { _pin->setDriveMode(mode); }
+
+	[[nodiscard]] static constexpr int pinNumber() noexcept { return Pin; }
+
+private:
+	std::shared_ptr<GpioPin> _pin;
+};
+
+}
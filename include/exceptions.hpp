@@ -156,6 +156,31 @@ private:
     char msg[128]{};
 };
 
+/**
+ *  Thread policy failure exception
+ *
+ *  System call @member op failed with error @member err while applying the thread policy
+ */
+struct thread_policy_exception : public access_exception
+{
+    thread_policy_exception(int err, const char* op) : err(err), op(op)
+    {
+        sprintf(msg, "Applying the thread policy failed in %s with errno %d: %s", op, err, strerror(err));
+    }
+
+    [[nodiscard]]
+    /* virtual */ const char* what() const noexcept override
+    {
+        return msg;
+    }
+
+    int err;
+    const char* op;
+
+private:
+    char msg[128]{};
+};
+
 }
 
 #endif // EXCEPTIONS_HPP
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Devices
+{
+
+/**
+ *  Runs the tasks posted to it, on threads of its choice
+ *
+ *  post() is called from the interrupt engine threads of the providers, so it should return
+ *  quickly and must not block on the tasks it runs.
+ */
+class IExecutor
+{
+public:
+	virtual ~IExecutor() {}
+
+	virtual void post(std::function<void()> task) = 0;
+};
+
+/**
+ *  Fixed pool of worker threads, each with its own task queue
+ *
+ *  Tasks posted from outside the pool are spread round robin, tasks posted by a worker stay
+ *  in its own queue. An idle worker steals the oldest task of another worker before going
+ *  to sleep. No ordering between tasks is guaranteed, tasks still queued when the executor
+ *  is destroyed are dropped.
+ */
+class WorkStealingExecutor final : public IExecutor
+{
+public:
+	explicit WorkStealingExecutor(std::size_t threads = std::thread::hardware_concurrency());
+	~WorkStealingExecutor() override;
+
+	WorkStealingExecutor(WorkStealingExecutor const&) = delete;
+	WorkStealingExecutor& operator=(WorkStealingExecutor const&) = delete;
+
+	void post(std::function<void()> task) override;
+
+	[[nodiscard]] std::size_t threads() const noexcept { return _workers.size(); }
+
+private:
+	struct worker_t
+	{
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+		std::thread thread;
+	};
+
+	void run(std::size_t index);
+	bool take(std::size_t index, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<worker_t>> _workers;
+	std::atomic<std::size_t> _next{0};
+
+	/* Tasks posted and not yet taken, lets workers sleep without missing a post */
+	std::atomic<std::size_t> _pending{0};
+	std::mutex _sleepLock;
+	std::condition_variable _wake;
+	std::atomic_bool _running{true};
+};
+
+}
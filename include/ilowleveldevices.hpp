@@ -1,9 +1,11 @@
 #pragma once
 #include <memory>
-#include "ipwm.hpp"
-#include "ispi.hpp"
-#include "ii2c.hpp"
-#include "igpio.hpp"
+#include "providers/pwm/ipwm.hpp"
+#include "providers/spi/ispi.hpp"
+#include "providers/i2c/ii2c.hpp"
+#include "providers/gpio/igpio.hpp"
+#include "executor.hpp"
+#include "threadpolicy.hpp"
 
 namespace Devices
 {
@@ -19,6 +21,27 @@ struct ILowLevelDevicesAggregateProvider
 struct LowLevelDevicesController
 {
 	static ILowLevelDevicesAggregateProvider* defaultProvider;
+
+	/**
+	 *  Where GPIO interrupt callbacks run
+	 *
+	 *  Without an executor (the default) callbacks run inline on the interrupt engine thread,
+	 *  which is the lowest latency but lets a slow callback delay every other pin. With one,
+	 *  the engine only queues the events and the callbacks of a pin run on the executor, one
+	 *  at a time and in order. Applies to callbacks enabled after the call.
+	 */
+	static void setCallbackExecutor(std::shared_ptr<IExecutor> executor);
+	[[nodiscard]] static std::shared_ptr<IExecutor> getCallbackExecutor();
+
+	/**
+	 *  Scheduling, affinity and memory locking of every thread the library runs
+	 *
+	 *  Applied to the running threads immediately and to every thread started later. Throws
+	 *  LLD::thread_policy_exception when the process lacks the privileges (CAP_SYS_NICE,
+	 *  RLIMIT_MEMLOCK) for it.
+	 */
+	static void setThreadPolicy(ThreadPolicy const& policy);
+	[[nodiscard]] static ThreadPolicy getThreadPolicy();
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "igpio.hpp"
+#include <linux/gpio.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Devices::Gpio::Provider
+{
+
+/**
+ *  Edge event reader of the character device provider
+ *
+ *  Line request fds are registered with a single epoll instance, the reader thread drains
+ *  every ready fd in batches of gpio_v2_line_event records and hands them to the handler
+ *  registered for that fd. Any fd delivering whole records works, a pipe fed with recorded
+ *  events included. Handlers are reclaimed the same way as in DMAGpioPoller. remove() returns
+ *  once the reader holds no reference to the handler anymore, the fd may be closed and the
+ *  owner of the handler destroyed right after. Called from a handler, it only guarantees
+ *  the removed handler is neither read nor called again.
+ */
+class CDevEventReader
+{
+public:
+	using Handler = std::function<void(gpio_v2_line_event const&)>;
+	static constexpr std::size_t batchSize = 16;
+
+	CDevEventReader();
+	~CDevEventReader();
+
+	CDevEventReader(CDevEventReader const&) = delete;
+	CDevEventReader& operator=(CDevEventReader const&) = delete;
+
+	void add(int fd, Handler fn);
+	void remove(int fd);
+
+	static CDevEventReader& instance();
+
+private:
+	struct handler_t
+	{
+		int fd;
+		Handler fn;
+		/* Set by remove(), the reader checks it before every read and dispatch */
+		std::atomic_bool dead{false};
+	};
+
+	void run();
+	void reclaim();
+
+	int _epoll;
+	int _wakeup;
+
+	std::mutex _lock;
+	std::vector<handler_t*> _handlers;
+	std::vector<handler_t*> _retired;
+	std::atomic_bool _pendingReclaim{false};
+	/* Passes of the reader through the top of its loop, where it holds no handler */
+	std::atomic<uint64_t> _passes{0};
+
+	std::thread _thread;
+	std::atomic_bool _running{false};
+};
+
+/* Chip fd and info shared by the controller and every line requested from it */
+struct CDevChip
+{
+	explicit CDevChip(std::string const& path);
+	~CDevChip();
+
+	int fd;
+	gpiochip_info info;
+};
+
+class CDevGpioControllerProvider final : public IGpioControllerProvider
+{
+	friend class CDevGpioProvider;
+public:
+	IGpioPinProvider* open(int) override;
+	IGpioPortProvider* openPort(uint64_t) override;
+
+	[[nodiscard]] int base() const override;
+	[[nodiscard]] int count() const override;
+	[[nodiscard]] std::string name() const override;
+
+private:
+	explicit CDevGpioControllerProvider(std::shared_ptr<CDevChip> chip) : _chip(std::move(chip)) {}
+
+	std::shared_ptr<CDevChip> _chip;
+};
+
+class CDevGpioPinProvider final : public IGpioPinProvider
+{
+	friend class CDevGpioControllerProvider;
+public:
+	~CDevGpioPinProvider() override;
+
+	[[nodiscard]] PinValue read() const override;
+	void write(PinValue) override;
+
+	[[nodiscard]] PinDriveMode getDriveMode() const override;
+	void setDriveMode(PinDriveMode) override;
+
+	void enableInterrupt(PinEdge, _Isr) override;
+	int enableEventFd(PinEdge) override;
+	std::size_t readEvents(GpioEvent*, std::size_t) override;
+	[[nodiscard]] int pinNumber() const noexcept override { return _pin; }
+
+	/* The glitch filter is the kernel's debounce attribute. The debounce lockout drops edges
+	 * in software, without a timer to report a trailing edge */
+	void setFilter(PinFilter const&) override;
+	[[nodiscard]] uint64_t suppressedEdges() const noexcept override;
+
+private:
+	CDevGpioPinProvider(std::shared_ptr<CDevChip> chip, int pin);
+
+	void configure(uint64_t flags);
+	bool setEdge(PinEdge edge);
+	bool accept(GpioEvent const& event);
+
+	std::shared_ptr<CDevChip> _chip;
+	int _pin;
+	int _fd;
+
+	/* Direction/bias and edge flags are reconfigured separately */
+	uint64_t _modeFlags{0};
+	uint64_t _edgeFlags{0};
+
+	uint32_t _glitchUs{0};
+	std::atomic<uint64_t> _debounceNs{0};
+	/* Reading thread only */
+	uint64_t _lockUntil{0};
+	std::atomic<uint64_t> _suppressed{0};
+};
+
+/* One line request for every line of the port, values are set and read with a single ioctl */
+class CDevGpioPortProvider final : public IGpioPortProvider
+{
+	friend class CDevGpioControllerProvider;
+public:
+	~CDevGpioPortProvider() override;
+
+	[[nodiscard]] uint64_t read() const override;
+	void write(uint64_t mask, uint64_t value) override;
+	void toggle(uint64_t mask) override;
+
+	void setDriveMode(PinDriveMode) override;
+
+private:
+	CDevGpioPortProvider(std::shared_ptr<CDevChip> chip, uint64_t pins);
+
+	/* Controller bits <-> bits of the line request, lines are requested in ascending order */
+	uint64_t toLines(uint64_t bits) const noexcept;
+	uint64_t fromLines(uint64_t lines) const noexcept;
+
+	std::shared_ptr<CDevChip> _chip;
+	std::vector<int> _offsets;
+	int _fd;
+};
+
+class CDevGpioProvider final : public IGpioProvider
+{
+public:
+	[[nodiscard]] ControllerProviderList getControllers() const override;
+	[[nodiscard]] ControllerProviderList getControllers(std::string const&) const override;
+
+	static CDevGpioProvider* getInstance() noexcept;
+
+private:
+	CDevGpioProvider() = default;
+	~CDevGpioProvider() override = default;
+};
+
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "igpio.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct gpio_base_t;
+
+namespace Devices::Gpio::Provider
+{
+
+/**
+ *  How the interrupt engine waits for events
+ *
+ *  After every event the poller busy-spins for spinWindow, then sleeps minSleep and doubles
+ *  the sleep on every idle round up to maxSleep. Equal minSleep and maxSleep without a spin
+ *  window give a fixed polling interval.
+ */
+struct PollingPolicy
+{
+	std::chrono::microseconds spinWindow;
+	std::chrono::microseconds minSleep;
+	std::chrono::microseconds maxSleep;
+};
+
+/**
+ *  Pin to pin reaction evaluated by the poller itself
+ *
+ *  An edge on any of the trigger pins drives the set pins high and the clear pins low, with
+ *  one store per register and bank, before any handler runs. With a delay the stores happen
+ *  that long after the edge was seen, as precisely as the polling policy allows. Masks are
+ *  indexed by pin number and the target pins have to be outputs already.
+ */
+struct ReflexRule
+{
+	uint64_t trigger;
+	PinEdge edge;
+	uint64_t set;
+	uint64_t clear;
+	std::chrono::microseconds delay{0};
+};
+
+/**
+ *  Interrupt engine of the DMA GPIO provider
+ *
+ *  The GPIO block latches the armed edges in GPEDS, a single thread polls it and dispatches
+ *  the handlers of the pins that fired. Handlers sit in a table indexed by pin number, each
+ *  slot being published atomically, so the poller never takes a lock. Replaced handlers are
+ *  retired and freed by the poller itself once it passes a point where it holds none of them.
+ *  The thread runs only while at least one pin is armed.
+ *
+ *  GPEDS latches a single edge per pin, so edges are timestamped at the poll that sees them
+ *  and several edges between two polls count as one. The edge is the armed one, or for
+ *  PinEdge::Both the level sampled right after the poll. Level handlers get that sample of
+ *  every pin instead.
+ *
+ *  Pins with a PinFilter detect both edges and go through the filter stage, which tracks
+ *  the level of the pin across polls and reports the edges that pass. While a filter waits
+ *  for a deadline, the idle sleep never runs past it.
+ *
+ *  Reflex rules see the raw edges of their trigger pins, unfiltered, and are applied before
+ *  the handlers of the same poll are dispatched. The thread also runs while rules are set.
+ */
+class DMAGpioPoller
+{
+public:
+	static constexpr int pinCount = 54;
+
+	static DMAGpioPoller& instance();
+
+	/* Set up edge detection of a pin and publish its handler, replacing the previous one */
+	void arm(int pin, PinEdge edge, _Isr fn);
+	/* Same for a handler taking the levels of the poll, on both edges and unfiltered */
+	void armLevels(int pin, _LevelIsr fn);
+	/* Once it returns, the handler of the pin is not running and never will be again */
+	void disarm(int pin);
+
+	void setFilter(int pin, PinFilter const& filter);
+	[[nodiscard]] uint64_t suppressed(int pin) const noexcept { return _suppressed[pin].load(std::memory_order_relaxed); }
+
+	static constexpr int maxReflexes = 32;
+
+	/* Returns the id of the rule, the rule may fire before the call returns */
+	int addReflex(ReflexRule const& rule);
+	/* Once it returns, the rule does not fire any more (delayed stores may still be due) */
+	void removeReflex(int id);
+	/* How many times the rule fired */
+	[[nodiscard]] uint64_t reflexCount(int id) const noexcept;
+
+	void setPollingPolicy(PollingPolicy const& policy);
+	[[nodiscard]] PollingPolicy getPollingPolicy();
+
+	DMAGpioPoller(DMAGpioPoller const&) = delete;
+	DMAGpioPoller& operator=(DMAGpioPoller const&) = delete;
+
+private:
+	struct handler_t
+	{
+		_Isr fn;
+		PinEdge edge;
+		_LevelIsr levels;
+	};
+
+	struct rule_t
+	{
+		uint64_t trigger;
+		PinEdge edge;
+		uint64_t set;
+		uint64_t clear;
+		uint64_t delay;		/* ns */
+		std::atomic<uint64_t> fired{0};
+	};
+
+	struct delayed_t
+	{
+		uint64_t due;		/* ns */
+		uint64_t set;
+		uint64_t clear;
+	};
+
+	/* Filter stage of one pin, levels are 0/1 */
+	struct filter_state_t
+	{
+		bool valid;			/* reported holds a level */
+		bool reported;		/* last level passed on (whether a handler wanted that edge or not) */
+		bool pending;		/* candidate waiting out the glitch time */
+		bool candidate;
+		bool trailing;		/* edges were suppressed during the debounce lockout */
+		uint64_t since;		/* ns, when the candidate level appeared */
+		uint64_t lockUntil;	/* ns, end of the debounce lockout */
+	};
+
+	DMAGpioPoller();
+	~DMAGpioPoller();
+
+	void start();
+	void run();
+	void program(int pin);
+	uint64_t reflex(uint64_t rising, uint64_t falling, uint64_t now);
+	uint64_t delayed(uint64_t now);
+	void drive(uint64_t set, uint64_t clear);
+	void dispatch(uint64_t rising, uint64_t falling, uint64_t levels, uint64_t timestamp);
+	uint64_t filter(uint64_t events, uint64_t filtered, uint64_t levels, uint64_t now);
+	void pass(int pin, bool level, uint64_t timestamp);
+	void report(int pin, bool level, uint64_t timestamp);
+	void reclaim();
+	void retire(handler_t* handler);
+
+	volatile gpio_base_t* _regs;
+
+	std::array<std::atomic<handler_t*>, pinCount> _handlers{};
+	std::atomic<uint64_t> _armed{0};
+	/* Armed pins whose handler takes levels */
+	std::atomic<uint64_t> _levelPins{0};
+
+	/* Edges the hardware detects, so the poller knows which one a GPEDS bit stands for */
+	std::atomic<uint64_t> _risingOnly{0};
+	std::atomic<uint64_t> _fallingOnly{0};
+	std::atomic<uint64_t> _bothEdges{0};
+
+	/* Published like the handlers, _reflexEdge/_reflexPins are what the rules need detected */
+	std::array<std::atomic<rule_t*>, maxReflexes> _reflexes{};
+	std::array<PinEdge, pinCount> _reflexEdge{};
+	std::atomic<uint64_t> _reflexPins{0};
+
+	/* Filter configuration in ns, _filterReset asks the poller to start the pin afresh */
+	std::array<std::atomic<uint64_t>, pinCount> _glitch{};
+	std::array<std::atomic<uint64_t>, pinCount> _debounce{};
+	std::atomic<uint64_t> _filtered{0};
+	std::atomic<uint64_t> _filterReset{0};
+	std::array<std::atomic<uint64_t>, pinCount> _suppressed{};
+
+	/* Touched by the poller only */
+	std::array<uint64_t, pinCount> _sequence{};
+	std::array<filter_state_t, pinCount> _filterState{};
+	uint64_t _active{0};
+	std::vector<delayed_t> _delayed;
+	/* Odd while rules and handlers are being evaluated */
+	std::atomic<uint64_t> _round{0};
+
+	/* Serialises arm/disarm, the poller only ever try-locks it to reclaim handlers */
+	std::mutex _lock;
+	std::vector<handler_t*> _retired;
+	std::atomic_bool _pendingReclaim{false};
+
+	/* Guards the policy and the thread's lifetime, wakes the poller from its idle sleep */
+	std::mutex _stateLock;
+	std::condition_variable _wake;
+	PollingPolicy _policy;
+	bool _policyChanged{false};
+
+	std::thread _thread;
+	std::atomic_bool _running{false};
+};
+
+}
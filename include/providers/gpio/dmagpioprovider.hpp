@@ -1,11 +1,12 @@
 #pragma once
 
 #include "igpio.hpp"
+#include "dmagpiopoller.hpp"
 #include <memory>
-#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <thread>
-#include <map>
+
+struct gpio_base_t;
 
 namespace Devices::Gpio::Provider
 {
@@ -15,10 +16,12 @@ class DMAGpioControllerProvider final : public IGpioControllerProvider
 	friend class DMAGpioProvider;
 public:
 	IGpioPinProvider* open(int) override;
+	IGpioPortProvider* openPort(uint64_t) override;
 
 	[[nodiscard]] int base() const override;
 	[[nodiscard]] int count() const override;
 	[[nodiscard]] std::string name() const override;
+	[[nodiscard]] bool isMemoryMapped() const noexcept override { return true; }
 
 private:
 	/* virtual */ ~DMAGpioControllerProvider() override = default;
@@ -27,6 +30,7 @@ private:
 class DMAGpioPinProvider final : public IGpioPinProvider
 {
 	friend class DMAGpioControllerProvider;
+	friend class DMAGpioPortProvider;
 public:
 	[[nodiscard]] PinValue read() const override;
 	void write(PinValue) override;
@@ -36,28 +40,62 @@ public:
 
 	void enableInterrupt(PinEdge, _Isr) override;
 	[[nodiscard]] int pinNumber() const noexcept override { return _pin; }
+	bool enableLevelInterrupt(_LevelIsr) override;
+
+	void setFilter(PinFilter const&) override;
+	[[nodiscard]] uint64_t suppressedEdges() const noexcept override;
 
+	/* Fixed polling interval, shorthand for an equivalent PollingPolicy */
 	template<typename Rep, typename Period>
 	static void setPollingAccuracy(std::chrono::duration<Rep, Period> const& accuracy)
     {
-	    _poll.pollingAccuracy = std::min(_poll.pollingAccuracy, accuracy);
+	    auto interval = std::chrono::duration_cast<std::chrono::microseconds>(accuracy);
+	    DMAGpioPoller::instance().setPollingPolicy({std::chrono::microseconds{0}, interval, interval});
     }
 
+	static void setPollingPolicy(PollingPolicy const& policy) { DMAGpioPoller::instance().setPollingPolicy(policy); }
+	static PollingPolicy getPollingPolicy() { return DMAGpioPoller::instance().getPollingPolicy(); }
+
+	/* Pin to pin reactions applied by the interrupt engine, see ReflexRule */
+	static int addReflex(ReflexRule const& rule) { return DMAGpioPoller::instance().addReflex(rule); }
+	static void removeReflex(int id) { DMAGpioPoller::instance().removeReflex(id); }
+	static uint64_t reflexCount(int id) noexcept { return DMAGpioPoller::instance().reflexCount(id); }
+
+	/* virtual */ ~DMAGpioPinProvider() override;
+
 private:
 	int _pin, _pinBank;
 	uint32_t _pinBit;
 
-	explicit DMAGpioPinProvider(int pin) :
-		_pin(pin), _pinBank(pin/32), _pinBit(1 << (pin % 32))
-	{
-	}
-
-    static struct poll {
-        std::thread instance{};
-        std::map<int, std::function<void(PinEdge)>> map{};
-        std::chrono::microseconds pollingAccuracy{1000};
-        std::atomic_bool running{true};
-    } _poll;
+	/* Registers of the pin's bank, resolved once so the hot path is a single access */
+	volatile gpio_base_t* _regs;
+	volatile uint32_t* _set;
+	volatile uint32_t* _clr;
+	volatile uint32_t* _lev;
+
+	bool _armed{false};
+	bool _filtered{false};
+
+	explicit DMAGpioPinProvider(int pin);
+};
+
+class DMAGpioPortProvider final : public IGpioPortProvider
+{
+	friend class DMAGpioControllerProvider;
+public:
+	[[nodiscard]] uint64_t read() const override;
+	void write(uint64_t mask, uint64_t value) override;
+	void toggle(uint64_t mask) override;
+
+	void setDriveMode(PinDriveMode) override;
+
+private:
+	explicit DMAGpioPortProvider(uint64_t pins);
+
+	/* At most one GPSET, one GPCLR and one GPLEV access per bank the port spans */
+	uint64_t _pins;
+	bool _low, _high;
+	volatile gpio_base_t* _regs;
 };
 
 class DMAGpioProvider final : public IGpioProvider
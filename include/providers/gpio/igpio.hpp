@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <vector>
@@ -32,7 +34,39 @@ namespace Gpio {
 		Both
 	};
 
-	using _Isr = std::function<void(PinEdge)>;
+	/**
+	 *  Single edge reported by the interrupt engine of a provider
+	 *
+	 *  The timestamp is taken from CLOCK_MONOTONIC (std::chrono::steady_clock), in ns. Sequence
+	 *  numbers count the events of one pin from 1, a gap means the edges were lost before they
+	 *  could be reported (e.g. the kernel event queue overflowed).
+	 */
+	struct GpioEvent
+	{
+		int pin;
+		PinEdge edge;
+		uint64_t timestamp;
+		uint64_t sequence;
+	};
+
+	using _Isr = std::function<void(GpioEvent const&)>;
+	/* Levels of the controller's pins (bit n = pin n) sampled once per poll, and the poll's timestamp */
+	using _LevelIsr = std::function<void(uint64_t levels, uint64_t timestamp)>;
+
+	/**
+	 *  Edge filter applied by the interrupt engine, before any consumer sees the edge
+	 *
+	 *  glitch - the new level has to stay stable this long before the edge is reported, with
+	 *  the time the level changed. Shorter pulses are dropped.
+	 *  debounce - after a reported edge, further edges are suppressed this long. Should the
+	 *  level then differ from the reported one, that edge is reported at the end.
+	 *  Zero disables either stage.
+	 */
+	struct PinFilter
+	{
+		std::chrono::microseconds glitch{0};
+		std::chrono::microseconds debounce{0};
+	};
 
 namespace Provider{
 
@@ -47,8 +81,39 @@ public:
 	virtual PinDriveMode getDriveMode() const = 0;
 	virtual void setDriveMode(PinDriveMode) = 0;
 
-	virtual void enableInterrupt(PinEdge, std::function<void(PinEdge)>) = 0;
+	virtual void enableInterrupt(PinEdge, _Isr) = 0;
 	virtual int pinNumber() const noexcept = 0;
+
+	/* Handler run on both edges of the pin with the levels of all pins taken by a single read,
+	 * so pins decoded together are seen coherently. Replaces the interrupt handler, filters do
+	 * not apply. Returns false when the provider does not sample its pins together */
+	virtual bool enableLevelInterrupt(_LevelIsr) { return false; }
+
+	virtual void setFilter(PinFilter const&) = 0;
+	/* Edges the filter kept from the consumers so far */
+	virtual uint64_t suppressedEdges() const noexcept = 0;
+
+	/* Edges read straight from a pollable fd by the caller, instead of a handler. Returns -1
+	 * when the provider has no such fd, readEvents() never blocks */
+	virtual int enableEventFd(PinEdge) { return -1; }
+	virtual std::size_t readEvents(GpioEvent*, std::size_t) { return 0; }
+};
+
+/**
+ *  Group of pins accessed together
+ *
+ *  Bit n of every mask corresponds to the pin base() + n of the owning controller.
+ */
+class IGpioPortProvider
+{
+public:
+	virtual ~IGpioPortProvider() {}
+
+	virtual uint64_t read() const = 0;
+	virtual void write(uint64_t mask, uint64_t value) = 0;
+	virtual void toggle(uint64_t mask) = 0;
+
+	virtual void setDriveMode(PinDriveMode) = 0;
 };
 
 class IGpioControllerProvider
@@ -57,9 +122,13 @@ public:
 	virtual ~IGpioControllerProvider() {}
 
 	virtual IGpioPinProvider* open(int) = 0;
+	virtual IGpioPortProvider* openPort(uint64_t pins) = 0;
 	virtual int base() const = 0;
 	virtual int count() const = 0;
 	virtual std::string name() const = 0;
+
+	/* Pins are backed by the bcm_gpioPerip() register block */
+	virtual bool isMemoryMapped() const noexcept { return false; }
 };
 
 using ControllerProviderList = std::vector<std::unique_ptr<IGpioControllerProvider>>;
@@ -9,7 +9,9 @@ namespace Devices::Pwm::Provider
     class DMAPwmProvider : public IPwmProvider
     {
     public:
+        /* Every PWM block of the running SoC, PWM0 first */
         /* virtual */ [[nodiscard]] ControllerProviderList getControllers() const final;
+        /* The one named so ("PWM0", "PWM1"), all of them for nullptr or "" */
         /* virtual */ [[nodiscard]] ControllerProviderList getControllers(const char*) const final;
 
         static DMAPwmProvider* getInstance() noexcept;
@@ -27,10 +29,21 @@ namespace Devices::Pwm::Provider
         /* virtual */ [[nodiscard]] const char* name() const NOEXCEPT override;
         /* virtual */ [[nodiscard]] int  count() const NOEXCEPT override;
 
+        /* RNG and DAT of both channels are written back to back and CTL once, registers already
+         * holding the staged value are skipped */
+        /* virtual */ bool commit(PwmChannelUpdate const* updates, std::size_t count) NOEXCEPT override;
+
+        /* Writes the shadowed CTL of a controller to the register again, for changes that reset
+         * it behind the provider (the PWM clock). The shadow is loaded from the register on first
+         * use, so call it once before such a change too */
+        static void rewriteCtl(int controller) NOEXCEPT;
+
     private:
         int id;
     };
 
+    /* Range, data and polarity are read from a software copy of the registers shared by the
+     * channels of a controller, CTL changes go through it without a lock */
     class DMAPwmChannelProvider : public IPwmChannelProvider
     {
     public:
@@ -53,6 +66,14 @@ namespace Devices::Pwm::Provider
 
         /* virtual */ [[nodiscard]] int channel() const NOEXCEPT override { return channelID; }
 
+        /* The controller has a single FIFO (FIF1), a channel in FIFO mode takes every word */
+        /* virtual */ bool enableFifo(bool) NOEXCEPT override;
+        /* virtual */ std::size_t writeFifo(uint32_t const*, std::size_t) NOEXCEPT override;
+        /* virtual */ bool fifoGap() NOEXCEPT override;
+        /* DREQ 5 on PWM0, 1 on PWM1 (the BCM2711 shares it with DSI0) */
+        /* virtual */ bool enableDma(bool, FifoDmaTarget*) NOEXCEPT override;
+        /* virtual */ bool setSerializer(bool) NOEXCEPT override;
+
     private:
         int controllerID;
         int channelID;
@@ -1,7 +1,9 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <optional>
 
 #define NOEXCEPT noexcept
 
@@ -17,6 +19,22 @@ namespace Devices::Pwm
 	namespace Provider
 	{
 
+        /* Settings staged for one channel, only the engaged ones are applied */
+        struct PwmChannelUpdate
+        {
+            std::optional<uint32_t> range;
+            std::optional<uint32_t> data;
+            std::optional<Polarity> polarity;
+            std::optional<bool> enable;
+        };
+
+        /* What a DMA control block feeding the FIFO targets */
+        struct FifoDmaTarget
+        {
+            uint32_t busAddress;    /* of the FIFO register */
+            int dreq;               /* peripheral number (PERMAP) of the FIFO's DMA request */
+        };
+
         class IPwmChannelProvider
         {
         public:
@@ -35,6 +53,20 @@ namespace Devices::Pwm
             [[nodiscard]] virtual bool isRunning() const NOEXCEPT = 0;
 
             [[nodiscard]] virtual int channel() const NOEXCEPT = 0;
+
+            /* FIFO mode, the channel takes its data from the FIFO at the PWM cycle rate instead of
+             * from DAT. Returns false when the channel has no FIFO */
+            virtual bool enableFifo(bool) NOEXCEPT { return false; }
+            /* Writes samples until the FIFO is full, returns how many it took */
+            virtual std::size_t writeFifo(uint32_t const*, std::size_t) NOEXCEPT { return 0; }
+            /* Whether the FIFO ran dry while the channel was transmitting, since the last call */
+            virtual bool fifoGap() NOEXCEPT { return false; }
+            /* DMA pacing, the FIFO raises its DMA request whenever it has room. Fills target when
+             * enabling, returns false when the FIFO cannot be fed by DMA */
+            virtual bool enableDma(bool, FifoDmaTarget*) NOEXCEPT { return false; }
+            /* Serializer mode, every data word is shifted out MSB first over range clock cycles.
+             * Returns false when the channel cannot serialize */
+            virtual bool setSerializer(bool) NOEXCEPT { return false; }
         };
 
         class IPwmControllerProvider
@@ -46,6 +78,10 @@ namespace Devices::Pwm
 
             [[nodiscard]] virtual const char* name() const NOEXCEPT = 0;
             [[nodiscard]] virtual int  count() const NOEXCEPT = 0;
+
+            /* Applies the updates of channels 0 to count-1 so they take effect in the same PWM
+             * period. Returns false when the controller cannot */
+            virtual bool commit(PwmChannelUpdate const*, std::size_t) NOEXCEPT { return false; }
         };
 
         using ControllerProviderList = std::vector<std::unique_ptr<IPwmControllerProvider>>;
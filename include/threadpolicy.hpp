@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Devices
+{
+
+/**
+ *  Scheduling of the threads owned by the library
+ *
+ *  Covers the interrupt engines of the providers and the callback executor workers. The
+ *  simulated SoC stands in for hardware and is left alone.
+ */
+struct ThreadPolicy
+{
+	enum class Scheduler
+	{
+		Other,		/* SCHED_OTHER, priority is ignored */
+		Fifo,		/* SCHED_FIFO */
+		RoundRobin	/* SCHED_RR */
+	};
+
+	Scheduler scheduler{Scheduler::Other};
+	int priority{0};
+	/* CPUs the threads may run on, any when empty */
+	std::vector<int> cpus;
+	/* mlockall(MCL_CURRENT | MCL_FUTURE), so no page fault ever hits a library thread */
+	bool lockMemory{false};
+	/* Bytes of stack touched when a thread starts, threads already running are not affected.
+	 * At most the default thread stack size less 64KiB */
+	std::size_t stackPrefault{0};
+};
+
+/**
+ *  Registry of the threads owned by the library
+ *
+ *  Every library thread is started through spawn(), which applies the current policy to it
+ *  and keeps it registered while it runs, so a new policy reaches the running threads too.
+ */
+class LibraryThreads
+{
+public:
+	LibraryThreads() = delete;
+
+	template<typename Fn, typename... Args>
+	[[nodiscard]] static std::thread spawn(Fn&& fn, Args&&... args)
+	{
+		return std::thread(&LibraryThreads::run<std::decay_t<Fn>, std::decay_t<Args>...>,
+						   std::forward<Fn>(fn), std::forward<Args>(args)...);
+	}
+
+	static void setPolicy(ThreadPolicy const& policy);
+	[[nodiscard]] static ThreadPolicy getPolicy();
+
+private:
+	struct registration_t
+	{
+		registration_t();
+		~registration_t();
+	};
+
+	template<typename Fn, typename... Args>
+	static void run(Fn fn, Args... args)
+	{
+		registration_t registration;
+		std::invoke(std::move(fn), std::move(args)...);
+	}
+};
+
+}
@@ -2,133 +2,439 @@
 // Created by Lukas Miklosko on 8/16/21.
 //
 
-#include <array>
-#include <memory>
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include "exceptions.hpp"
 #include "bcm_host.hpp"
+#include "bcm_sim.hpp"
 
-static unsigned get_dt_ranges(const char *filename, unsigned offset)
+static std::atomic<bcm_backend> backend{bcm_backend::Auto};
+static std::atomic_bool mapped{false};
+
+void bcm_setBackend(bcm_backend b)
 {
-    unsigned address = ~0;
-    FILE *fp = fopen(filename, "rb");
-    if (fp)
+    if (mapped && b != bcm_getBackend())
     {
-        unsigned char buf[4];
-        fseek(fp, offset, SEEK_SET);
-        if (fread(buf, 1, sizeof buf, fp) == sizeof buf)
-            address = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3] << 0;
-        fclose(fp);
+        throw LLD::not_supported_exception{};
     }
-    return address;
+    backend = b;
+}
+
+bcm_backend bcm_getBackend()
+{
+    if (auto b = backend.load(); b != bcm_backend::Auto)
+    {
+        return b;
+    }
+
+    auto env = getenv("LLD_BACKEND");
+    auto b = (env && strcmp(env, "sim") == 0) ? bcm_backend::Simulated : bcm_backend::DevMem;
+
+    auto expected = bcm_backend::Auto;
+    backend.compare_exchange_strong(expected, b);
+    return backend;
+}
+
+static std::size_t read_dt(const char* path, unsigned char* buf, std::size_t size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        return 0;
+    }
+    auto len = fread(buf, 1, size, fp);
+    fclose(fp);
+    return len;
+}
+
+static uint32_t dt_cell(unsigned char const* p)
+{
+    return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3] << 0;
+}
+
+/*
+ *  /proc/device-tree/soc/ranges holds <bus address> <cpu address> <size> cells, the cpu
+ *  address takes #address-cells of the root node. That is two on the BCM2711, whose upper
+ *  cell is non-zero when the firmware maps the peripherals above 4GB (arm_peri_high).
+ */
+struct dt_ranges
+{
+    uint64_t address;
+    unsigned size;
+};
+
+static dt_ranges const& get_dt_ranges()
+{
+    static const dt_ranges ranges = []{
+        dt_ranges r{0x20000000, 0x01000000};
+
+        unsigned char buf[16];
+        auto len = read_dt("/proc/device-tree/soc/ranges", buf, sizeof buf);
+        if (len >= 12)
+        {
+            /* Without #address-cells, a zero cpu address can only be the upper cell of two */
+            unsigned char cells[4];
+            const auto addressCells = read_dt("/proc/device-tree/#address-cells", cells, sizeof cells) == sizeof cells
+                                      ? dt_cell(cells) : (dt_cell(buf + 4) == 0 ? 2 : 1);
+            if (addressCells == 2 && len >= 16)
+            {
+                r.address = uint64_t{dt_cell(buf + 4)} << 32 | dt_cell(buf + 8);
+                r.size = dt_cell(buf + 12);
+            }
+            else if (addressCells == 1)
+            {
+                r.address = dt_cell(buf + 4);
+                r.size = dt_cell(buf + 8);
+            }
+        }
+        return r;
+    }();
+    return ranges;
 }
 
-unsigned bcm_getPeripheralAddress()
+uint64_t bcm_getPeripheralAddress()
 {
-    unsigned address = get_dt_ranges("/proc/device-tree/soc/ranges", 4);
-    if (address == 0)
-        address = get_dt_ranges("/proc/device-tree/soc/ranges", 8);
-    return address == ~0U ? 0x20000000 : address;
+    return get_dt_ranges().address;
 }
 
 unsigned bcm_getPeripheralSize()
 {
-    unsigned address = get_dt_ranges("/proc/device-tree/soc/ranges", 4);
-    address = get_dt_ranges("/proc/device-tree/soc/ranges", (address == 0) ? 12 : 8);
-    return address == ~0U ? 0x01000000 : address;
+    return get_dt_ranges().size;
 }
 
-template<typename Tp, std::size_t N>
-class Storage
+/* The root node lists the SoC among its compatible strings, the peripheral base is the fallback */
+static bcm_soc detectSoc()
 {
-    static constexpr auto deleter = [](Tp* ptr) { munmap((void*)(ptr), sizeof(Tp)); };
+    char buf[256];
+    auto len = read_dt("/proc/device-tree/compatible", reinterpret_cast<unsigned char*>(buf), sizeof buf - 1);
+    if (len > 0)
+    {
+        buf[len] = '\0';
+        for (std::size_t i = 0; i < len; i += strlen(buf + i) + 1)
+        {
+            if (strcmp(buf + i, "brcm,bcm2711") == 0)
+            {
+                return bcm_soc::BCM2711;
+            }
+        }
+        return bcm_soc::BCM2835;
+    }
+
+    const auto address = bcm_getPeripheralAddress();
+    return address == 0xFE000000 || address == 0x47C000000 ? bcm_soc::BCM2711 : bcm_soc::BCM2835;
+}
 
-    template<size_t ... indices>
-    explicit Storage(std::index_sequence<indices...> const&)
-        : ptr{((void)indices, ptr_type(nullptr, deleter))...}
+bcm_soc bcm_getSoc()
+{
+    if (bcm_getBackend() == bcm_backend::Simulated)
     {
+        return bcm_soc::BCM2711;
     }
-public:
-    using ptr_type = std::unique_ptr<Tp, decltype(deleter)>;
-    std::array<ptr_type, N> ptr;
 
-    Storage() : Storage(std::make_index_sequence<N>{}) {}
+    static const bcm_soc soc = detectSoc();
+    return soc;
+}
+
+std::size_t bcm_numPwmControllers()
+{
+    return bcm_getSoc() == bcm_soc::BCM2711 ? 2 : 1;
+}
+
+static constexpr unsigned dmaOffset  = 0x00007000;
+static constexpr unsigned pmOffset   = 0x00100000;
+static constexpr unsigned clkOffset  = 0x00101000;
+static constexpr unsigned gpioOffset = 0x00200000;
+static constexpr unsigned pcmOffset  = 0x00203000;
+static constexpr unsigned pwmOffset  = 0x0020C000;
+static constexpr unsigned pwmStride  = 0x00000800;
+
+/**
+ *  The whole peripheral window, mapped once
+ *
+ *  Without access to /dev/mem the GPIO block alone is mapped through /dev/gpiomem, every
+ *  other block is unavailable then. The mapping lives for the rest of the process, library
+ *  threads may still be touching registers during static destruction.
+ */
+struct peripheral_window_t
+{
+    uint8_t* base;
+    bool gpioOnly;
 };
-#include <iostream>
-template<typename Tp, size_t nControllers = 1, size_t offset = 0>
-static Tp* getPeripheralPtr(unsigned address, int idx = 0)
+
+static peripheral_window_t mapWindow()
 {
-    static Storage<Tp, nControllers> storage;
+    int fd;
+    std::size_t size;
+    off_t address;
+    bool gpioOnly = false;
 
-    if (!storage.ptr[idx])
+    if (auto sim = bcm_simulator())
     {
-        int fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
-        if (fd < 0)
-        {
-            throw LLD::access_exception{};
-        }
+        fd = dup(sim->fd());
+        size = SimulatedSoc::peripheralSize;
+        address = 0;
+    }
+    else if ((fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC)) >= 0)
+    {
+        size = bcm_getPeripheralSize();
+        address = bcm_getPeripheralAddress();
+    }
+    else
+    {
+        fd = open("/dev/gpiomem", O_RDWR | O_SYNC | O_CLOEXEC);
+        size = sizeof(gpio_base_t);
+        address = 0;
+        gpioOnly = true;
+    }
+
+    if (fd < 0)
+    {
+        throw LLD::access_exception{};
+    }
+
+    auto virtaddr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, address);
+    close(fd);
 
-        auto virtaddr = mmap(nullptr, sizeof(Tp), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, bcm_getPeripheralAddress() | (address + offset * idx));
-        if (virtaddr == MAP_FAILED)
+    if (virtaddr == MAP_FAILED)
+    {
+        throw LLD::memory_access_exception{};
+    }
+
+    mapped = true;
+    return {static_cast<uint8_t*>(virtaddr), gpioOnly};
+}
+
+static peripheral_window_t const& window()
+{
+    /* A throwing initializer leaves the window unmapped, next access retries */
+    static const peripheral_window_t window = mapWindow();
+    return window;
+}
+
+template<typename Tp>
+static volatile Tp* getPeripheralPtr(unsigned offset)
+{
+    auto const& w = window();
+    if (w.gpioOnly)
+    {
+        if (offset != gpioOffset)
         {
             throw LLD::memory_access_exception{};
         }
-
-        close(fd);
-        storage.ptr[idx].reset(reinterpret_cast<Tp*>(virtaddr));
+        return reinterpret_cast<volatile Tp*>(w.base);
     }
-
-    return storage.ptr[idx].get();
+    return reinterpret_cast<volatile Tp*>(w.base + offset);
 }
 
 [[maybe_unused]]
 volatile dma_base_t* bcm_dmaPerip()
 {
-    return getPeripheralPtr<volatile dma_base_t>(0x00007000);
+    return getPeripheralPtr<dma_base_t>(dmaOffset);
+}
+[[maybe_unused]]
+volatile dma_channel_t* bcm_dmaChannel(int channel)
+{
+    if (channel < 0 || channel >= 15)
+    {
+        throw LLD::invalid_argument_exception("bcm_dmaChannel()", "channel >= 0 && channel < 15", std::to_string(channel));
+    }
+    /* Through the offset, the block is only ever accessed as a whole otherwise */
+    return getPeripheralPtr<dma_channel_t>(dmaOffset + sizeof(dma_channel_t) * channel);
 }
 [[maybe_unused]]
 volatile power_management_t* bcm_pmPerip()
 {
-    return getPeripheralPtr<volatile power_management_t>(0x00100000);
+    return getPeripheralPtr<power_management_t>(pmOffset);
 }
 [[maybe_unused]]
 volatile clock_management_t* bcm_clkPerip()
 {
-    return getPeripheralPtr<volatile clock_management_t>(0x00101000);
+    return getPeripheralPtr<clock_management_t>(clkOffset);
 }
 [[maybe_unused]]
 volatile gpio_base_t* bcm_gpioPerip()
 {
-    return getPeripheralPtr<volatile gpio_base_t>(0x00200000);
+    return getPeripheralPtr<gpio_base_t>(gpioOffset);
 }
 [[maybe_unused]]
 volatile pcm_base_t* bcm_pcmPerip()
 {
-    return getPeripheralPtr<volatile pcm_base_t>(0x00203000);
+    return getPeripheralPtr<pcm_base_t>(pcmOffset);
 }
 [[maybe_unused]]
 volatile pwm_base_t *bcm_pwmPerip(std::size_t idx)
 {
-    return getPeripheralPtr<pwm_base_t, 2, 0x800>(0x0020C000, idx);
+    if (idx >= bcm_numPwmControllers())
+    {
+        throw LLD::invalid_argument_exception("bcm_pwmPerip()", "idx < bcm_numPwmControllers()", std::to_string(idx));
+    }
+    return getPeripheralPtr<pwm_base_t>(pwmOffset + pwmStride * idx);
 }
 
-#include <unordered_map>
-#include <tuple>
-static std::unordered_map<int, std::tuple<int,int,int>> pwmAltFunctions =
+uint32_t bcm_busAddress(volatile void const* reg)
+{
+    /* The peripherals sit at 0x7E000000 on the VideoCore bus on every SoC */
+    auto const& w = window();
+    return 0x7E000000 + static_cast<uint32_t>(reinterpret_cast<uint8_t const volatile*>(reg) - w.base);
+}
+
+/*
+ *  VideoCore mailbox property interface, see the firmware wiki. A request is a buffer of
+ *  <size> <code> followed by tags of <id> <value size> <request size> <values> and an end tag,
+ *  the answer comes back in place.
+ */
+#define IOCTL_MBOX_PROPERTY _IOWR(100, 0, char*)
+
+static constexpr uint32_t mboxMemAlloc   = 0x0003000c;
+static constexpr uint32_t mboxMemLock    = 0x0003000d;
+static constexpr uint32_t mboxMemUnlock  = 0x0003000e;
+static constexpr uint32_t mboxMemRelease = 0x0003000f;
+
+/* MEM_FLAG_DIRECT (0xC alias, uncached) or MEM_FLAG_L1_NONALLOCATING where that alias is the L2 cached one */
+static constexpr uint32_t memFlagDirect = 1 << 2;
+static constexpr uint32_t memFlagL1NonAllocating = 3 << 2;
+
+/* Returns the first value of the answer, 0 on failure */
+static uint32_t mailboxCall(uint32_t tag, std::initializer_list<uint32_t> values)
+{
+    int fd = open("/dev/vcio", O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    uint32_t buf[16]{};
+    std::size_t i = 2;
+    buf[i++] = tag;
+    buf[i++] = static_cast<uint32_t>(values.size() * sizeof(uint32_t));
+    buf[i++] = static_cast<uint32_t>(values.size() * sizeof(uint32_t));
+    for (auto value : values)
+    {
+        buf[i++] = value;
+    }
+    buf[i++] = 0;
+    buf[0] = static_cast<uint32_t>(i * sizeof(uint32_t));
+
+    const bool ok = ioctl(fd, IOCTL_MBOX_PROPERTY, buf) >= 0 && buf[1] == 0x80000000;
+    close(fd);
+    return ok ? buf[5] : 0;
+}
+
+bool bcm_dmaAlloc(std::size_t size, bcm_dma_memory* out)
 {
-        {12, {0,0,0}},
-        {13, {0,1,0}},
-        {18, {0,0,5}},
-        {19, {0,1,5}},
+    if (auto sim = bcm_simulator())
+    {
+        return sim->allocate(size, out);
+    }
+
+    const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    size = (size + page - 1) / page * page;
+
+    /* Only the BCM2835 (peripherals at 0x20000000) maps the 0xC alias through the L2 cache */
+    const auto flags = bcm_getPeripheralAddress() == 0x20000000 ? memFlagL1NonAllocating : memFlagDirect;
+    const auto handle = mailboxCall(mboxMemAlloc, {static_cast<uint32_t>(size), static_cast<uint32_t>(page), flags});
+    if (!handle)
+    {
+        return false;
+    }
 
-        {40, {1,0,0}},
-        {41, {1,1,0}},
-        {45, {0,1,0}},
+    const auto bus = mailboxCall(mboxMemLock, {handle});
+    int fd = bus ? open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC) : -1;
+    auto virtaddr = fd >= 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, bus & ~0xC0000000) : MAP_FAILED;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    if (virtaddr == MAP_FAILED)
+    {
+        if (bus)
+        {
+            mailboxCall(mboxMemUnlock, {handle});
+        }
+        mailboxCall(mboxMemRelease, {handle});
+        return false;
+    }
+
+    memset(virtaddr, 0, size);
+    *out = {static_cast<uint8_t*>(virtaddr), bus, size, handle};
+    return true;
+}
+
+void bcm_dmaFree(bcm_dma_memory* memory)
+{
+    if (!memory->virt)
+    {
+        return;
+    }
+
+    if (auto sim = bcm_simulator())
+    {
+        sim->release(*memory);
+    }
+    else
+    {
+        munmap(memory->virt, memory->size);
+        mailboxCall(mboxMemUnlock, {memory->handle});
+        mailboxCall(mboxMemRelease, {memory->handle});
+    }
+    *memory = {};
+}
+
+void bcm_gpioClearEvents(std::size_t bank, uint32_t mask)
+{
+    if (auto sim = bcm_simulator())
+    {
+        sim->clearEvents(bank, mask);
+    }
+    else
+    {
+        bcm_gpioPerip()->GPEDS[bank] = mask;
+    }
+}
+
+/* The pins keep their function on the BCM2711, only 40 and 41 move over to the second controller */
+static constexpr struct
+{
+    int pin;
+    int alt;
+    int channel;
+    std::size_t controller[2];  /* BCM2835, BCM2711 */
+} pwmRouting[] =
+{
+        {12, 0, 0, {0, 0}},
+        {13, 0, 1, {0, 0}},
+        {18, 5, 0, {0, 0}},
+        {19, 5, 1, {0, 0}},
+
+        {40, 0, 0, {0, 1}},
+        {41, 0, 1, {0, 1}},
+        {45, 0, 1, {0, 0}},
 };
 
+bool bcm_pwmRoute(int pin, bcm_pwm_route* out)
+{
+    for (auto const& route : pwmRouting)
+    {
+        if (route.pin == pin)
+        {
+            *out = {route.alt, route.controller[bcm_getSoc() == bcm_soc::BCM2711 ? 1 : 0], route.channel};
+            return true;
+        }
+    }
+    return false;
+}
+
+#include <unordered_map>
+#include <tuple>
+
 static std::unordered_map<int, std::tuple<int,int>> gpclkAltFunctions =
 {
         {4, {0,0}},
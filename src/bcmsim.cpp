@@ -0,0 +1,549 @@
+//
+// Simulated SoC peripheral window
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "exceptions.hpp"
+#include "bcm_sim.hpp"
+
+static constexpr unsigned dmaOffset  = 0x00007000;
+static constexpr unsigned gpioOffset = 0x00200000;
+static constexpr unsigned clkOffset  = 0x00101000;
+static constexpr unsigned pwmOffset[] = {0x0020C000, 0x0020C800};
+static constexpr int pwmDreq[] = {5, 1};
+
+static constexpr uint32_t peripheralBus = 0x7E000000;
+
+/* Rates of the clock manager sources on the BCM2711, by CTL.SRC */
+static constexpr double sourceRates[16] = {0.0, 54e6, 0.0, 0.0, 0.0, 1e9, 750e6, 216e6};
+
+static constexpr uint32_t PWM_CTL_PWEN2 = PWM_CTL_PWEN1 << 8;
+static constexpr uint32_t PWM_STA_EMPT1 = 1 << 1;
+static constexpr uint32_t PWM_STA_STA1  = 1 << 9;
+static constexpr uint32_t PWM_STA_STA2  = 1 << 10;
+
+/* Registers shared with the library are plain memory, these keep the model's updates atomic */
+static inline uint32_t exchange(volatile uint32_t& reg, uint32_t value)
+{
+    return __atomic_exchange_n(&reg, value, __ATOMIC_ACQ_REL);
+}
+static inline bool compareExchange(volatile uint32_t& reg, uint32_t expected, uint32_t value)
+{
+    return __atomic_compare_exchange_n(&reg, &expected, value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+/* Status bits of a register the library writes whole, its control bits are kept */
+static inline void updateBits(volatile uint32_t& reg, uint32_t clear, uint32_t set)
+{
+    uint32_t value = reg;
+    while (!__atomic_compare_exchange_n(&reg, &value, (value & ~clear) | set, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+    }
+}
+
+SimulatedSoc::SimulatedSoc() :
+    _clocks{
+        {offsetof(clock_management_t, GP[0].CTL), offsetof(clock_management_t, GP[0].DIV), 0, 0},
+        {offsetof(clock_management_t, GP[1].CTL), offsetof(clock_management_t, GP[1].DIV), 0, 0},
+        {offsetof(clock_management_t, GP[2].CTL), offsetof(clock_management_t, GP[2].DIV), 0, 0},
+        {offsetof(clock_management_t, PCMCTL), offsetof(clock_management_t, PCMDIV), 0, 0},
+        {offsetof(clock_management_t, PWMCTL), offsetof(clock_management_t, PWMDIV), 0, 0},
+    }
+{
+    _fd = memfd_create("lld-simulated-soc", MFD_CLOEXEC);
+    if (_fd < 0)
+    {
+        throw LLD::access_exception{};
+    }
+
+    if (ftruncate(_fd, peripheralSize) < 0)
+    {
+        close(_fd);
+        throw LLD::access_exception{};
+    }
+
+    auto virtaddr = mmap(nullptr, peripheralSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (virtaddr == MAP_FAILED)
+    {
+        close(_fd);
+        throw LLD::memory_access_exception{};
+    }
+    _base = static_cast<uint8_t*>(virtaddr);
+
+    virtaddr = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (virtaddr == MAP_FAILED)
+    {
+        munmap(_base, peripheralSize);
+        close(_fd);
+        throw LLD::memory_access_exception{};
+    }
+    _arena = static_cast<uint8_t*>(virtaddr);
+}
+
+SimulatedSoc::~SimulatedSoc()
+{
+    stop();
+    munmap(_arena, arenaSize);
+    munmap(_base, peripheralSize);
+    close(_fd);
+}
+
+void SimulatedSoc::start(std::chrono::nanoseconds period)
+{
+    if (_running.exchange(true))
+    {
+        return;
+    }
+
+    _thread = std::thread([this, period]{
+        while (_running)
+        {
+            step();
+            if (period.count() == 0)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(period);
+            }
+        }
+    });
+}
+
+void SimulatedSoc::stop()
+{
+    _running = false;
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+void SimulatedSoc::step()
+{
+    stepGpio();
+    stepClocks();
+    stepDma();
+    stepPwm();
+    ++_ticks;
+}
+
+void SimulatedSoc::driveInput(int pin, bool level)
+{
+    if (pin < 0 || pin >= pinCount)
+    {
+        throw LLD::invalid_argument_exception("SimulatedSoc::driveInput()",
+                                              "pin >= 0 && pin < pinCount",
+                                              std::to_string(pin));
+    }
+
+    const uint64_t bit = uint64_t{1} << pin;
+    if (level)
+    {
+        _inputs |= bit;
+    }
+    else
+    {
+        _inputs &= ~bit;
+    }
+    _driven |= bit;
+}
+
+bool SimulatedSoc::level(int pin) const
+{
+    auto gpio = block<gpio_base_t>(gpioOffset);
+    return (gpio->GPLEV[pin / 32] & (1u << (pin % 32))) != 0;
+}
+
+void SimulatedSoc::clearEvents(std::size_t bank, uint32_t mask)
+{
+    auto gpio = block<gpio_base_t>(gpioOffset);
+    __atomic_fetch_and(&gpio->GPEDS[bank], ~mask, __ATOMIC_ACQ_REL);
+}
+
+void SimulatedSoc::stepGpio()
+{
+    auto gpio = block<gpio_base_t>(gpioOffset);
+
+    /* Pins with function select 0b001 drive their output latch */
+    uint64_t outputs = 0;
+    for (int pin = 0; pin < pinCount; ++pin)
+    {
+        if (((gpio->GPFSEL[pin / 10] >> (3 * (pin % 10))) & 0x7) == 0b001)
+        {
+            outputs |= uint64_t{1} << pin;
+        }
+    }
+
+    for (std::size_t bank = 0; bank < 2; ++bank)
+    {
+        const auto shift = 32 * bank;
+        /* The order of the writes is lost, see the limitations in bcm_sim.hpp */
+        _latch |= uint64_t{exchange(gpio->GPSET[bank], 0)} << shift;
+        _latch &= ~(uint64_t{exchange(gpio->GPCLR[bank], 0)} << shift);
+
+        /* GPPUD is latched on the rising edge of a pin's clock, floating inputs read low */
+        const auto clk = uint64_t{gpio->GPPUDCLK[bank]} << shift;
+        const auto asserted = clk & ~_pudClock;
+        _pudClock = (_pudClock & ~(uint64_t{0xffffffff} << shift)) | clk;
+        if (asserted)
+        {
+            const auto pud = gpio->GPPUD & 0b11;
+            _pullUp = (_pullUp & ~asserted) | (pud == 0b10 ? asserted : 0);
+        }
+    }
+
+    const uint64_t driven = _driven;
+    const uint64_t inputs = (_inputs & driven) | (_pullUp & ~driven);
+    const uint64_t level = (_latch & outputs) | (inputs & ~outputs);
+
+    const uint64_t rising = level & ~_level;
+    const uint64_t falling = ~level & _level;
+    _level = level;
+
+    for (std::size_t bank = 0; bank < 2; ++bank)
+    {
+        const auto shift = 32 * bank;
+        const auto lev = static_cast<uint32_t>(level >> shift);
+        const auto rise = static_cast<uint32_t>(rising >> shift);
+        const auto fall = static_cast<uint32_t>(falling >> shift);
+
+        gpio->GPLEV[bank] = lev;
+
+        const uint32_t events = (rise & (gpio->GPREN[bank] | gpio->GPAREN[bank])) |
+                                (fall & (gpio->GPFEN[bank] | gpio->GPAFEN[bank])) |
+                                (lev & gpio->GPHEN[bank]) |
+                                (~lev & gpio->GPLEN[bank]);
+        if (events)
+        {
+            __atomic_fetch_or(&gpio->GPEDS[bank], events, __ATOMIC_ACQ_REL);
+        }
+    }
+}
+
+void SimulatedSoc::stepClocks()
+{
+    auto base = _base + clkOffset;
+    for (auto& clk : _clocks)
+    {
+        auto& ctl = *reinterpret_cast<volatile uint32_t*>(base + clk.ctl);
+        auto& div = *reinterpret_cast<volatile uint32_t*>(base + clk.div);
+
+        /* Writes without the password are dropped, accepted ones are read back without it */
+        if (uint32_t value = div; value != clk.divValue)
+        {
+            if ((value & 0xff000000) == BCM_PASSWORD)
+            {
+                clk.divValue = value & 0x00ffffff;
+            }
+            compareExchange(div, value, clk.divValue);
+        }
+
+        if (uint32_t written = ctl; written != clk.ctlValue)
+        {
+            if ((written & 0xff000000) == BCM_PASSWORD)
+            {
+                uint32_t value = written & 0x00ffffff;
+                if (value & CLK_CTL_KILL)
+                {
+                    value &= ~(CLK_CTL_KILL | CLK_CTL_ENAB);
+                }
+
+                /* The generator is busy for as long as it is enabled */
+                clk.ctlValue = (value & CLK_CTL_ENAB) ? (value | CLK_CTL_BUSY) : (value & ~CLK_CTL_BUSY);
+            }
+            compareExchange(ctl, written, clk.ctlValue);
+        }
+    }
+}
+
+bool SimulatedSoc::allocate(std::size_t size, bcm_dma_memory* out)
+{
+    const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    size = (size + page - 1) / page * page;
+
+    std::lock_guard<std::mutex> guard(_arenaLock);
+
+    /* First fit */
+    std::size_t offset = 0;
+    for (auto const& [start, length] : _allocations)
+    {
+        if (start - offset >= size)
+        {
+            break;
+        }
+        offset = start + length;
+    }
+    if (size == 0 || offset + size > arenaSize)
+    {
+        return false;
+    }
+
+    _allocations.emplace(static_cast<uint32_t>(offset), static_cast<uint32_t>(size));
+    memset(_arena + offset, 0, size);
+    *out = {_arena + offset, static_cast<uint32_t>(arenaBus + offset), size, 0};
+    return true;
+}
+
+void SimulatedSoc::release(bcm_dma_memory const& memory)
+{
+    std::lock_guard<std::mutex> guard(_arenaLock);
+    _allocations.erase(memory.bus - arenaBus);
+}
+
+volatile uint32_t* SimulatedSoc::busWord(uint32_t bus) const
+{
+    if (bus & 3)
+    {
+        return nullptr;
+    }
+    if (bus >= arenaBus && bus - arenaBus < arenaSize)
+    {
+        return reinterpret_cast<volatile uint32_t*>(_arena + (bus - arenaBus));
+    }
+    if (bus >= peripheralBus && bus - peripheralBus < peripheralSize)
+    {
+        return reinterpret_cast<volatile uint32_t*>(_base + (bus - peripheralBus));
+    }
+    return nullptr;
+}
+
+/* Copies the control block at CONBLK_AD into the channel registers, stops the channel at the
+ * end of the chain or on a block it cannot read */
+bool SimulatedSoc::loadBlock(int channel)
+{
+    auto regs = block<dma_channel_t>(dmaOffset + sizeof(dma_channel_t) * channel);
+    const uint32_t address = regs->controlBlockAddress;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    auto cb = busWord(address);
+    if (address == 0 || (address & 31) || !cb)
+    {
+        updateBits(regs->controlStatus, DMA_CS_ACTIVE, address ? DMA_CS_ERROR : DMA_CS_END);
+        _dmaLoaded[channel] = false;
+        _dmaRunning[channel] = false;
+        return false;
+    }
+
+    regs->transferInformation = cb[0];
+    regs->sourceAddress = cb[1];
+    regs->destinationAddress = cb[2];
+    regs->transferLength = cb[3];
+    regs->d2Stride = cb[4];
+    regs->nextCBAddress = cb[5];
+    updateBits(regs->controlStatus, DMA_CS_END | DMA_CS_INT | DMA_CS_ERROR, 0);
+    _dmaLoaded[channel] = true;
+    _dmaRunning[channel] = true;
+    return true;
+}
+
+/* Moves up to words words of the loaded block, and on to the next block once it is done.
+ * Returns how many it moved */
+std::size_t SimulatedSoc::transfer(int channel, std::size_t words)
+{
+    auto regs = block<dma_channel_t>(dmaOffset + sizeof(dma_channel_t) * channel);
+    const uint32_t ti = regs->transferInformation;
+    uint32_t source = regs->sourceAddress;
+    uint32_t destination = regs->destinationAddress;
+    uint32_t length = regs->transferLength;
+
+    const auto n = std::min<std::size_t>(words, length / 4);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        auto from = busWord(source);
+        auto to = busWord(destination);
+        if (!from || !to)
+        {
+            updateBits(regs->controlStatus, DMA_CS_ACTIVE, DMA_CS_ERROR);
+            _dmaRunning[channel] = false;
+            return i;
+        }
+        *to = *from;
+        source += (ti & DMA_TI_SRC_INC) ? 4 : 0;
+        destination += (ti & DMA_TI_DEST_INC) ? 4 : 0;
+        length -= 4;
+    }
+    regs->sourceAddress = source;
+    regs->destinationAddress = destination;
+    regs->transferLength = length;
+
+    if (length < 4)
+    {
+        regs->controlBlockAddress = regs->nextCBAddress;
+        if (ti & DMA_TI_INTEN)
+        {
+            updateBits(regs->controlStatus, 0, DMA_CS_INT);
+        }
+        loadBlock(channel);
+    }
+    return n;
+}
+
+void SimulatedSoc::stepDma()
+{
+    const uint32_t enabled = block<dma_base_t>(dmaOffset)->ENABLE;
+    for (int channel = 0; channel < 15; ++channel)
+    {
+        auto regs = block<dma_channel_t>(dmaOffset + sizeof(dma_channel_t) * channel);
+        const uint32_t cs = regs->controlStatus;
+        _dmaRunning[channel] = false;
+
+        if (cs & DMA_CS_RESET)
+        {
+            regs->controlBlockAddress = 0;
+            regs->transferInformation = 0;
+            regs->sourceAddress = 0;
+            regs->destinationAddress = 0;
+            regs->transferLength = 0;
+            regs->d2Stride = 0;
+            regs->nextCBAddress = 0;
+            _dmaLoaded[channel] = false;
+            exchange(regs->controlStatus, 0);
+            continue;
+        }
+        if (!(enabled & (1u << channel)))
+        {
+            continue;
+        }
+
+        /* Paused channels keep their registers for the library to inspect */
+        if (!(cs & DMA_CS_ACTIVE))
+        {
+            if (!(cs & DMA_CS_PAUSED))
+            {
+                updateBits(regs->controlStatus, 0, DMA_CS_PAUSED);
+            }
+            continue;
+        }
+        if (cs & DMA_CS_PAUSED)
+        {
+            updateBits(regs->controlStatus, DMA_CS_PAUSED, 0);
+        }
+
+        if (_dmaLoaded[channel])
+        {
+            _dmaRunning[channel] = true;
+        }
+        else if (!loadBlock(channel))
+        {
+            continue;
+        }
+
+        /* Unpaced blocks are done within the tick, a bounded number of them in case they loop */
+        for (int blocks = 0; blocks < 64 && _dmaRunning[channel] &&
+                             !(regs->transferInformation & (DMA_TI_SRC_DREQ | DMA_TI_DEST_DREQ)); ++blocks)
+        {
+            transfer(channel, regs->transferLength / 4);
+        }
+    }
+}
+
+/* Words the DMA channels paced by the DREQ of the controller deliver, up to words */
+std::size_t SimulatedSoc::feedFifo(std::size_t controller, std::size_t words)
+{
+    const uint32_t permap = DMA_TI_PERMAP(pwmDreq[controller]);
+    std::size_t fed = 0;
+    for (int channel = 0; channel < 15 && fed < words; ++channel)
+    {
+        auto regs = block<dma_channel_t>(dmaOffset + sizeof(dma_channel_t) * channel);
+        while (fed < words && _dmaRunning[channel])
+        {
+            const uint32_t ti = regs->transferInformation;
+            if (!(ti & DMA_TI_DEST_DREQ) || (ti & DMA_TI_PERMAP(0x1f)) != permap)
+            {
+                break;
+            }
+
+            fed += transfer(channel, words - fed);
+        }
+    }
+    return fed;
+}
+
+double SimulatedSoc::pwmClock() const
+{
+    auto const& clk = _clocks[4];
+    const auto divi = (clk.divValue >> 12) & 0xfff;
+    if (!(clk.ctlValue & CLK_CTL_ENAB) || divi == 0)
+    {
+        return 0.0;
+    }
+
+    const auto mash = (clk.ctlValue >> 9) & 0x3;
+    const double divider = mash ? divi + (clk.divValue & 0xfff) / 4096.0 : divi;
+    return sourceRates[clk.ctlValue & 0xf] / divider;
+}
+
+void SimulatedSoc::stepPwm()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = _lastTick.time_since_epoch().count() ? std::chrono::duration<double>(now - _lastTick).count() : 0.0;
+    _lastTick = now;
+    const double clock = pwmClock();
+
+    for (std::size_t controller = 0; controller < std::size(pwmOffset); ++controller)
+    {
+        auto pwm = block<pwm_base_t>(pwmOffset[controller]);
+        const uint32_t ctl = pwm->CTL;
+        auto& fifo = _pwmFifo[controller];
+
+        if (ctl & PWM_CTL_CLRF1)
+        {
+            fifo = 0;
+            compareExchange(pwm->CTL, ctl, ctl & ~PWM_CTL_CLRF1);
+        }
+
+        /* Every channel taking its data from the FIFO pops a word per period */
+        double rate = 0.0;
+        for (int channel = 0; channel < 2; ++channel)
+        {
+            const uint32_t bits = (PWM_CTL_PWEN1 | PWM_CTL_USEF1) << (8 * channel);
+            if ((ctl & bits) == bits && pwm->CHANNEL[channel].RNG)
+            {
+                rate += clock / pwm->CHANNEL[channel].RNG;
+            }
+        }
+
+        const double due = _pwmDue[controller] + elapsed * rate;
+        auto words = static_cast<std::size_t>(std::floor(due));
+        _pwmDue[controller] = due - words;
+
+        /* The DMA keeps the FIFO topped up in between ticks, it only runs dry when the DMA did */
+        const bool paced = (pwm->DMAC & PWM_DMAC_ENAB) != 0;
+        std::size_t taken = std::min(words, fifo);
+        fifo -= taken;
+        if (paced)
+        {
+            taken += feedFifo(controller, words - taken);
+            fifo += feedFifo(controller, pwmFifoDepth - fifo);
+        }
+        _pwmWords[controller] += taken;
+
+        pwm->STA = (fifo == 0 ? PWM_STA_EMPT1 : 0) |
+                   (fifo == pwmFifoDepth ? PWM_STA_FULL1 : 0) |
+                   ((ctl & PWM_CTL_PWEN1) ? PWM_STA_STA1 : 0) |
+                   ((ctl & PWM_CTL_PWEN2) ? PWM_STA_STA2 : 0);
+    }
+}
+
+SimulatedSoc* bcm_simulator()
+{
+    if (bcm_getBackend() != bcm_backend::Simulated)
+    {
+        return nullptr;
+    }
+
+    static SimulatedSoc* soc = []{
+        static SimulatedSoc instance;
+        instance.start();
+        return &instance;
+    }();
+    return soc;
+}
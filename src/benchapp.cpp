@@ -0,0 +1,353 @@
+#include "devices/pwm.hpp"
+#include "devices/pwmstream.hpp"
+#include "devices/ledstrip.hpp"
+#include "devices/gpio.hpp"
+#include "devices/staticgpio.hpp"
+#include "devices/quadratureencoder.hpp"
+#include "devices/pulsemeter.hpp"
+#include "devices/logiccapture.hpp"
+#include "devices/softpwm.hpp"
+#include "devices/outputscheduler.hpp"
+#include "clock.hpp"
+#include "ilowleveldevices.hpp"
+#include "bcm_sim.hpp"
+#include "providers/gpio/dmagpioprovider.hpp"
+#include "providers/gpio/cdevgpioprovider.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+/*
+ *  Hot path benchmarks, running against the simulated SoC unless LLD_BACKEND says otherwise.
+ */
+template<typename Fn>
+static void bench(const char* name, std::size_t iterations, Fn&& fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        fn(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(12) << std::fixed << std::setprecision(2)
+              << elapsed.count() / iterations << " ns/op" << std::endl;
+}
+
+int main()
+{
+    using namespace Devices;
+    using namespace Devices::Gpio;
+    using namespace Devices::Pwm;
+
+    using namespace Clocks;
+
+    if (!getenv("LLD_BACKEND"))
+    {
+        bcm_setBackend(bcm_backend::Simulated);
+    }
+
+    try
+    {
+        constexpr std::size_t iterations = 1000000;
+
+        auto gpio = GpioController::getDefault()->open(17);
+        gpio->setDriveMode(PinDriveMode::Output);
+
+        bench("GpioPin::write", iterations, [&](std::size_t i) {
+            gpio->write((i & 1) ? PinValue::High : PinValue::Low);
+        });
+        bench("GpioPin::read", iterations, [&](std::size_t) {
+            [[maybe_unused]] volatile auto v = gpio->read();
+        });
+        bench("GpioPin::getDriveMode", iterations, [&](std::size_t) {
+            [[maybe_unused]] volatile auto v = gpio->getDriveMode();
+        });
+
+        /* The simulated SoC is a BCM2711 */
+        StaticGpioPin<27, bcm_soc::BCM2711> fixed(*GpioController::getDefault());
+        fixed.setDriveMode(PinDriveMode::Output);
+
+        bench("StaticGpioPin::write", iterations, [&](std::size_t i) {
+            fixed.write((i & 1) ? PinValue::High : PinValue::Low);
+        });
+        bench("StaticGpioPin::toggle", iterations, [&](std::size_t) {
+            fixed.toggle();
+        });
+
+        auto port = GpioController::getDefault()->openPort({4, 5, 6, 12, 13, 16, 22, 23});
+        port->setDriveMode(PinDriveMode::Output);
+
+        bench("GpioPort::write (8 pins)", iterations, [&](std::size_t i) {
+            port->write(0xff, i);
+        });
+        bench("GpioPort::read (8 pins)", iterations, [&](std::size_t) {
+            [[maybe_unused]] volatile auto v = port->read();
+        });
+
+        {
+            SoftPwm pwm(port);
+            bench("SoftPwm::set", iterations, [&](std::size_t i) {
+                pwm.set(i & 7, 1000.0, (i & 255) / 255.0);
+            });
+
+            /* Eight channels at 1kHz, rising together. Edges made late by the set() benchmark
+             * competing for the CPU are not counted */
+            const auto before = pwm.lateEdges();
+            std::this_thread::sleep_for(100ms);
+            std::cout << std::left << std::setw(32) << "SoftPwm late edges (8ch, 100ms)"
+                      << std::right << std::setw(12) << pwm.lateEdges() - before << std::endl;
+        }
+
+        {
+            OutputScheduler scheduler(port);
+            const auto start = std::chrono::steady_clock::now() + 5ms;
+            bench("OutputScheduler::schedule", 1000, [&](std::size_t i) {
+                scheduler.schedule(start + i * 50us, (i & 1) ? 0 : 0xff, (i & 1) ? 0xff : 0);
+            });
+
+            std::this_thread::sleep_until(start + 60ms);
+            OutputResult results[1000];
+            const auto n = scheduler.readResults(results, 1000);
+            std::chrono::nanoseconds total{0}, worst{0};
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                total += results[i].lateness();
+                worst = std::max(worst, results[i].lateness());
+            }
+            std::cout << std::left << std::setw(32) << "OutputScheduler lateness"
+                      << std::right << std::setw(12) << std::fixed << std::setprecision(2)
+                      << (n ? static_cast<double>(total.count()) / n : 0.0) << " ns mean, "
+                      << worst.count() << " ns max" << std::endl;
+        }
+
+        GpioEventRing ring(256);
+        GpioEvent event{};
+        bench("GpioEventRing push+pop", iterations, [&](std::size_t i) {
+            event.sequence = i;
+            ring.push(event);
+            [[maybe_unused]] auto n = ring.pop(&event, 1);
+        });
+
+        {
+            /* A pipe stands in for a line request, the reader cannot tell the difference */
+            int line[2];
+            if (pipe2(line, O_CLOEXEC) == 0)
+            {
+                Gpio::Provider::CDevEventReader reader;
+                std::atomic<std::size_t> seen{0};
+                reader.add(line[0], [&seen](gpio_v2_line_event const&) { ++seen; });
+
+                gpio_v2_line_event record{};
+                bench("CDev record to handler (pipe)", 1000, [&](std::size_t i) {
+                    record.seqno = static_cast<uint32_t>(i);
+                    [[maybe_unused]] auto written = write(line[1], &record, sizeof record);
+                    while (seen <= i)
+                    {
+                        std::this_thread::yield();
+                    }
+                });
+
+                reader.remove(line[0]);
+                close(line[0]);
+                close(line[1]);
+            }
+        }
+
+        if (auto sim = bcm_simulator())
+        {
+            Gpio::Provider::DMAGpioPinProvider::setPollingAccuracy(10us);
+
+            auto input = GpioController::getDefault()->open(21);
+            input->setDriveMode(PinDriveMode::Input);
+
+            std::atomic<std::size_t> seen{0};
+            input->enableInterrupt(PinEdge::Both, [&seen](GpioPin*, PinEdge) { ++seen; });
+
+            bench("Edge to callback latency", 1000, [&](std::size_t i) {
+                sim->driveInput(21, (i & 1) == 0);
+                while (seen <= i)
+                {
+                    std::this_thread::yield();
+                }
+            });
+            input->enableInterrupt(PinEdge::None, nullptr);
+
+            LowLevelDevicesController::setCallbackExecutor(std::make_shared<WorkStealingExecutor>(2));
+            seen = 0;
+            input->enableInterrupt(PinEdge::Both, [&seen](GpioPin*, PinEdge) { ++seen; });
+
+            bench("Edge to callback (executor)", 1000, [&](std::size_t i) {
+                sim->driveInput(21, (i & 1) == 0);
+                while (seen <= i)
+                {
+                    std::this_thread::yield();
+                }
+            });
+            input->enableInterrupt(PinEdge::None, nullptr);
+            LowLevelDevicesController::setCallbackExecutor(nullptr);
+
+            input->enableEvents(PinEdge::Both);
+            bench("Edge to readEvents latency", 1000, [&](std::size_t i) {
+                sim->driveInput(21, (i & 1) == 0);
+                while (input->readEvents(&event, 1) == 0)
+                {
+                    std::this_thread::yield();
+                }
+            });
+
+            const int ep = epoll_create1(EPOLL_CLOEXEC);
+            epoll_event ready{};
+            ready.events = EPOLLIN;
+            epoll_ctl(ep, EPOLL_CTL_ADD, input->eventFd(), &ready);
+
+            bench("Edge to epoll + readEvents", 1000, [&](std::size_t i) {
+                sim->driveInput(21, (i & 1) == 0);
+                while (epoll_wait(ep, &ready, 1, -1) < 1 || input->readEvents(&event, 1) == 0)
+                {
+                }
+            });
+            close(ep);
+            input->enableEvents(PinEdge::None);
+
+            /* Pin 17 follows pin 21 without leaving the poll loop */
+            using Gpio::Provider::DMAGpioPinProvider;
+            const auto rise = DMAGpioPinProvider::addReflex({1ull << 21, PinEdge::Rising, 1ull << 17, 0});
+            const auto fall = DMAGpioPinProvider::addReflex({1ull << 21, PinEdge::Falling, 0, 1ull << 17});
+            bench("Edge to reflex output", 1000, [&](std::size_t i) {
+                const bool high = (i & 1) == 0;
+                sim->driveInput(21, high);
+                while ((gpio->read() == PinValue::High) != high)
+                {
+                    std::this_thread::yield();
+                }
+            });
+            DMAGpioPinProvider::removeReflex(rise);
+            DMAGpioPinProvider::removeReflex(fall);
+
+            auto channelB = GpioController::getDefault()->open(20);
+            channelB->setDriveMode(PinDriveMode::Input);
+            sim->driveInput(20, false);
+            sim->driveInput(21, false);
+            {
+                QuadratureEncoder encoder(input, channelB);
+                bench("Edge to encoder position", 1000, [&](std::size_t i) {
+                    /* Forward: A rises, B rises, A falls, B falls */
+                    sim->driveInput(i & 1 ? 20 : 21, (i & 2) == 0);
+                    while (encoder.position() <= static_cast<int64_t>(i))
+                    {
+                        std::this_thread::yield();
+                    }
+                });
+            }
+
+            {
+                PulseMeter meter(input);
+                auto lastEdge = meter.stats().lastEdge;
+                bench("Edge to PulseMeter stats", 1000, [&](std::size_t i) {
+                    sim->driveInput(21, (i & 1) == 0);
+                    while (meter.stats().lastEdge == lastEdge)
+                    {
+                        std::this_thread::yield();
+                    }
+                    lastEdge = meter.stats().lastEdge;
+                });
+                bench("PulseMeter::stats", iterations, [&](std::size_t) {
+                    [[maybe_unused]] auto stats = meter.stats();
+                });
+            }
+
+            {
+                /* The sampling thread spins, the benchmark only sleeps alongside it */
+                LogicCapture capture(1ull << 17, 1us);
+                capture.start();
+                std::this_thread::sleep_for(50ms);
+                capture.stop();
+                std::cout << std::left << std::setw(32) << "LogicCapture missed samples"
+                          << std::right << std::setw(12) << std::fixed << std::setprecision(2)
+                          << 100.0 * capture.missed() / capture.samples() << " %" << std::endl;
+            }
+        }
+
+        auto controller = PwmController::getDefault();
+        auto channel = controller->open(0);
+        channel->setRange(1024);
+        bench("PwmChannel::setData", iterations, [&](std::size_t i) {
+            channel->setData(i & 1023);
+        });
+        bench("PwmChannel::getData", iterations, [&](std::size_t) {
+            [[maybe_unused]] auto data = channel->getData();
+        });
+        ClockManager::SetPWMClock(ClockSource::PLLD, 2, 0);
+        channel->setFrequency(20000.0);
+        bench("PwmChannel::setDutyCycle", iterations, [&](std::size_t i) {
+            channel->setDutyCycle((i & 1023) / 1023.0);
+        });
+
+        {
+            /* Complementary pair, both duty cycles switch in the same period */
+            auto pair = controller->transaction();
+            bench("PwmTransaction::commit (2ch)", iterations, [&](std::size_t i) {
+                pair.setData(0, i & 1023).setData(1, 1023 - (i & 1023)).commit();
+            });
+        }
+
+        {
+            PwmStream stream(channel, 48000.0, 65536);
+            uint32_t samples[64];
+            for (std::size_t i = 0; i < 64; ++i)
+            {
+                samples[i] = static_cast<uint32_t>(i * 16);
+            }
+            bench("PwmStream::write (64 samples)", 1000, [&](std::size_t) {
+                [[maybe_unused]] auto n = stream.write(samples, 64);
+            });
+        }
+
+        {
+            /* DREQ paced DMA fed from the refill callback, no thread touches the FIFO */
+            PwmStream stream(channel, 48000.0, 8192);
+            stream.setRefill([](uint32_t* samples, std::size_t count) {
+                std::fill(samples, samples + count, 512);
+                return count;
+            });
+            std::this_thread::sleep_for(200ms);
+            std::cout << std::left << std::setw(32) << (stream.dma() ? "PwmStream underruns (DMA)" : "PwmStream underruns (thread)")
+                      << std::right << std::setw(12) << stream.underruns()
+                      << " in " << stream.played() << " samples" << std::endl;
+        }
+
+        {
+            /* Encode and shift out, 800kHz puts the transfer alone at 30ms */
+            LedStrip::takeClock();
+            LedStrip strip(channel, 1000);
+            std::vector<Rgb> colors(1000);
+            bench("LedStrip frame (1000 LEDs)", 10, [&](std::size_t i) {
+                std::fill(colors.begin(), colors.end(), Rgb{static_cast<uint8_t>(i), 0x40, 0x80});
+                strip.show(colors.data(), colors.size());
+                strip.flush();
+            });
+        }
+
+        bench("ClockManager::SetPWMClock", 100, [](std::size_t) {
+            ClockManager::SetPWMClock(ClockSource::PLLD, 2, 0);
+        });
+    }
+    catch (const std::exception & e)
+    {
+        std::cerr << "[ ERROR ] " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
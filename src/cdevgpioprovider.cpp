@@ -0,0 +1,661 @@
+#include "cdevgpioprovider.hpp"
+#include "exceptions.hpp"
+#include "filesystem.hpp"
+#include "threadpolicy.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using namespace Devices;
+using namespace Devices::Gpio;
+using namespace Devices::Gpio::Provider;
+
+static constexpr const char* consumerName = "lld";
+
+// ------------------------------------ Event reader ------------------------------------
+
+/* static */ CDevEventReader& CDevEventReader::instance()
+{
+	static CDevEventReader reader;
+	return reader;
+}
+
+CDevEventReader::CDevEventReader()
+{
+	_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (_epoll < 0)
+	{
+		throw LLD::access_exception{};
+	}
+
+	_wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (_wakeup < 0)
+	{
+		close(_epoll);
+		throw LLD::access_exception{};
+	}
+
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &ev);
+}
+
+CDevEventReader::~CDevEventReader()
+{
+	_running = false;
+	uint64_t one = 1;
+	[[maybe_unused]] auto written = ::write(_wakeup, &one, sizeof one);
+
+	if (_thread.joinable())
+	{
+		_thread.join();
+	}
+
+	for (auto handler : _handlers)
+	{
+		delete handler;
+	}
+	for (auto handler : _retired)
+	{
+		delete handler;
+	}
+
+	close(_wakeup);
+	close(_epoll);
+}
+
+void CDevEventReader::add(int fd, Handler fn)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	auto handler = new handler_t{fd, std::move(fn)};
+	auto it = std::find_if(_handlers.begin(), _handlers.end(), [fd](auto h){ return h->fd == fd; });
+
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.ptr = handler;
+	if (epoll_ctl(_epoll, it == _handlers.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) < 0)
+	{
+		delete handler;
+		throw LLD::ioctl_exception(fd, "epoll_ctl");
+	}
+
+	if (it != _handlers.end())
+	{
+		_retired.push_back(*it);
+		_pendingReclaim = true;
+		*it = handler;
+	}
+	else
+	{
+		_handlers.push_back(handler);
+	}
+
+	if (!_running.exchange(true))
+	{
+		/* A reader that stopped on an error is gone already */
+		if (_thread.joinable())
+		{
+			_thread.join();
+		}
+		_thread = LibraryThreads::spawn(&CDevEventReader::run, this);
+	}
+}
+
+void CDevEventReader::remove(int fd)
+{
+	bool reader;
+	uint64_t passes;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+
+		auto it = std::find_if(_handlers.begin(), _handlers.end(), [fd](auto h){ return h->fd == fd; });
+		if (it == _handlers.end())
+		{
+			return;
+		}
+
+		epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+		(*it)->dead = true;
+		_retired.push_back(*it);
+		_pendingReclaim = true;
+		_handlers.erase(it);
+		reader = _thread.get_id() == std::this_thread::get_id();
+		passes = _passes.load();
+	}
+
+	uint64_t one = 1;
+	[[maybe_unused]] auto written = ::write(_wakeup, &one, sizeof one);
+
+	/* A pointer returned by an epoll_wait before the removal may be in use until the reader
+	 * gets back to the top of its loop, the wakeup makes sure it does. A reader that has
+	 * stopped holds none */
+	if (!reader)
+	{
+		while (_passes.load() == passes && _running)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void CDevEventReader::reclaim()
+{
+	if (_pendingReclaim && _lock.try_lock())
+	{
+		for (auto handler : _retired)
+		{
+			delete handler;
+		}
+		_retired.clear();
+		_pendingReclaim = false;
+		_lock.unlock();
+	}
+}
+
+void CDevEventReader::run()
+{
+	epoll_event ready[8];
+	gpio_v2_line_event events[batchSize];
+
+	while (_running)
+	{
+		++_passes;
+		reclaim();
+
+		/* Anything but EINTR does not go away, the reader stops and the next add() starts over.
+		 * Nothing is held here, remove() returns as soon as it sees _running drop */
+		int n = epoll_wait(_epoll, ready, sizeof ready / sizeof ready[0], -1);
+		if (n < 0 && errno != EINTR)
+		{
+			_running = false;
+			break;
+		}
+
+		for (int i = 0; i < n; ++i)
+		{
+			auto handler = static_cast<handler_t*>(ready[i].data.ptr);
+			if (!handler)
+			{
+				uint64_t count;
+				[[maybe_unused]] auto rd = ::read(_wakeup, &count, sizeof count);
+				continue;
+			}
+
+			/* Drain the fd, a batch at a time */
+			while (!handler->dead)
+			{
+				auto len = ::read(handler->fd, events, sizeof events);
+				if (len < static_cast<ssize_t>(sizeof events[0]))
+				{
+					break;
+				}
+
+				auto count = static_cast<std::size_t>(len) / sizeof events[0];
+				for (std::size_t e = 0; e < count && !handler->dead; ++e)
+				{
+					handler->fn(events[e]);
+				}
+
+				if (count < batchSize)
+				{
+					break;
+				}
+			}
+		}
+	}
+}
+
+// --------------------------------------- Chip -----------------------------------------
+
+CDevChip::CDevChip(std::string const& path) : info{}
+{
+	fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+	{
+		throw LLD::access_exception{};
+	}
+
+	if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) < 0)
+	{
+		LLD::ioctl_exception e(fd, "GPIO_GET_CHIPINFO_IOCTL");
+		close(fd);
+		throw e;
+	}
+}
+
+CDevChip::~CDevChip()
+{
+	close(fd);
+}
+
+/* Request lines of the chip, the returned fd carries values, configuration and events */
+static int requestLines(CDevChip const& chip, std::vector<int> const& offsets, uint64_t flags)
+{
+	gpio_v2_line_request req{};
+	for (std::size_t i = 0; i < offsets.size(); ++i)
+	{
+		req.offsets[i] = offsets[i];
+	}
+	req.num_lines = offsets.size();
+	req.config.flags = flags;
+	strncpy(req.consumer, consumerName, sizeof req.consumer - 1);
+
+	if (ioctl(chip.fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+	{
+		if (errno == EBUSY)
+		{
+			throw LLD::access_violation_exception{};
+		}
+		throw LLD::ioctl_exception(chip.fd, "GPIO_V2_GET_LINE_IOCTL");
+	}
+	return req.fd;
+}
+
+static uint64_t modeFlags(PinDriveMode mode)
+{
+	switch (mode)
+	{
+	case PinDriveMode::Input:
+		return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+	case PinDriveMode::InputPullUp:
+		return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+	case PinDriveMode::InputPullDown:
+		return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+	case PinDriveMode::Output:
+		return GPIO_V2_LINE_FLAG_OUTPUT;
+	case PinDriveMode::OpenDrain:
+		return GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_OPEN_DRAIN;
+	case PinDriveMode::OpenSource:
+		return GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_OPEN_SOURCE;
+	default:
+		// alternate functions are not exposed by the character device
+		throw LLD::not_supported_exception{};
+	}
+}
+
+static void configureLines(int fd, uint64_t flags, uint32_t debounceUs = 0)
+{
+	gpio_v2_line_config config{};
+	config.flags = flags;
+	if (debounceUs && (flags & GPIO_V2_LINE_FLAG_INPUT))
+	{
+		/* Kernel debounce is a stable time, what PinFilter calls the glitch filter */
+		config.num_attrs = 1;
+		config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+		config.attrs[0].attr.debounce_period_us = debounceUs;
+		config.attrs[0].mask = 1;
+	}
+	if (ioctl(fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+	{
+		throw LLD::ioctl_exception(fd, "GPIO_V2_LINE_SET_CONFIG_IOCTL");
+	}
+}
+
+// ------------------------------------- Provider ---------------------------------------
+
+CDevGpioProvider* CDevGpioProvider::getInstance() noexcept
+{
+	static CDevGpioProvider _provider;
+	return &_provider;
+}
+
+ControllerProviderList CDevGpioProvider::getControllers() const
+{
+	return getControllers("");
+}
+
+ControllerProviderList CDevGpioProvider::getControllers(std::string const& name) const
+{
+	std::vector<std::string> paths;
+	std::error_code ec;
+	for (auto const& entry : std::filesystem::directory_iterator("/dev", ec))
+	{
+		if (entry.path().filename().string().rfind("gpiochip", 0) == 0)
+		{
+			paths.push_back(entry.path().string());
+		}
+	}
+	std::sort(paths.begin(), paths.end());
+
+	ControllerProviderList list;
+	for (auto const& path : paths)
+	{
+		try
+		{
+			auto chip = std::make_shared<CDevChip>(path);
+			if (name.empty() || name == chip->info.name || name == chip->info.label)
+			{
+				list.emplace_back(new CDevGpioControllerProvider(std::move(chip)));
+			}
+		}
+		catch (std::bad_alloc const&)
+		{
+			throw;
+		}
+		catch (...)
+		{
+		}
+	}
+	return list;
+}
+
+// ------------------------------------ Controller --------------------------------------
+
+IGpioPinProvider* CDevGpioControllerProvider::open(int pin)
+{
+	if (pin >= (base() + count()) || pin < base())
+	{
+		throw std::range_error("\'pin >= (base() + count()) || pin < base()\' condition not met.");
+	}
+
+	return new CDevGpioPinProvider(_chip, pin);
+}
+
+IGpioPortProvider* CDevGpioControllerProvider::openPort(uint64_t pins)
+{
+	if (count() < 64 && (pins >> count()))
+	{
+		throw std::range_error("\'pins\' mask exceeds the controller.");
+	}
+
+	return new CDevGpioPortProvider(_chip, pins);
+}
+
+int CDevGpioControllerProvider::base() const
+{
+	return 0;
+}
+
+int CDevGpioControllerProvider::count() const
+{
+	return static_cast<int>(_chip->info.lines);
+}
+
+std::string CDevGpioControllerProvider::name() const
+{
+	return _chip->info.label;
+}
+
+// ---------------------------------------- Pin -----------------------------------------
+
+CDevGpioPinProvider::CDevGpioPinProvider(std::shared_ptr<CDevChip> chip, int pin) :
+	_chip(std::move(chip)), _pin(pin)
+{
+	/* Neither direction flag requested leaves the line as it is */
+	_fd = requestLines(*_chip, {pin}, 0);
+}
+
+CDevGpioPinProvider::~CDevGpioPinProvider()
+{
+	if (_edgeFlags)
+	{
+		CDevEventReader::instance().remove(_fd);
+	}
+	close(_fd);
+}
+
+PinValue CDevGpioPinProvider::read() const
+{
+	gpio_v2_line_values values{0, 1};
+	if (ioctl(_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+	{
+		throw LLD::ioctl_exception(_fd, "GPIO_V2_LINE_GET_VALUES_IOCTL");
+	}
+	return (values.bits & 1) ? PinValue::High : PinValue::Low;
+}
+
+void CDevGpioPinProvider::write(PinValue val)
+{
+	gpio_v2_line_values values{val == PinValue::High ? 1u : 0u, 1};
+	if (ioctl(_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+	{
+		throw LLD::ioctl_exception(_fd, "GPIO_V2_LINE_SET_VALUES_IOCTL");
+	}
+}
+
+PinDriveMode CDevGpioPinProvider::getDriveMode() const
+{
+	gpio_v2_line_info info{};
+	info.offset = _pin;
+	if (ioctl(_chip->fd, GPIO_V2_GET_LINEINFO_IOCTL, &info) < 0)
+	{
+		throw LLD::ioctl_exception(_chip->fd, "GPIO_V2_GET_LINEINFO_IOCTL");
+	}
+
+	if (info.flags & GPIO_V2_LINE_FLAG_OUTPUT)
+	{
+		if (info.flags & GPIO_V2_LINE_FLAG_OPEN_DRAIN)
+			return PinDriveMode::OpenDrain;
+		if (info.flags & GPIO_V2_LINE_FLAG_OPEN_SOURCE)
+			return PinDriveMode::OpenSource;
+		return PinDriveMode::Output;
+	}
+
+	if (info.flags & GPIO_V2_LINE_FLAG_BIAS_PULL_UP)
+		return PinDriveMode::InputPullUp;
+	if (info.flags & GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN)
+		return PinDriveMode::InputPullDown;
+	return PinDriveMode::Input;
+}
+
+void CDevGpioPinProvider::setDriveMode(PinDriveMode mode)
+{
+	auto flags = modeFlags(mode);
+
+	/* Edge detection is only available on inputs */
+	configure(flags | ((flags & GPIO_V2_LINE_FLAG_INPUT) ? _edgeFlags : 0));
+	_modeFlags = flags;
+}
+
+void CDevGpioPinProvider::configure(uint64_t flags)
+{
+	configureLines(_fd, flags, _glitchUs);
+}
+
+void CDevGpioPinProvider::setFilter(PinFilter const& filter)
+{
+	_glitchUs = static_cast<uint32_t>(std::max<int64_t>(filter.glitch.count(), 0));
+	_debounceNs = static_cast<uint64_t>(std::max<int64_t>(std::chrono::nanoseconds(filter.debounce).count(), 0));
+
+	/* A line never configured yet picks the filter up with its first configuration */
+	if (_modeFlags)
+	{
+		configure(_modeFlags | ((_modeFlags & GPIO_V2_LINE_FLAG_INPUT) ? _edgeFlags : 0));
+	}
+}
+
+uint64_t CDevGpioPinProvider::suppressedEdges() const noexcept
+{
+	return _suppressed.load(std::memory_order_relaxed);
+}
+
+bool CDevGpioPinProvider::accept(GpioEvent const& event)
+{
+	/* Debounce lockout, on the thread reading the line */
+	const auto debounce = _debounceNs.load(std::memory_order_relaxed);
+	if (debounce && event.timestamp < _lockUntil)
+	{
+		_suppressed.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	_lockUntil = event.timestamp + debounce;
+	return true;
+}
+
+static GpioEvent toEvent(int pin, gpio_v2_line_event const& e)
+{
+	/* The kernel stamps events with CLOCK_MONOTONIC unless asked otherwise */
+	return GpioEvent{pin,
+					 e.id == GPIO_V2_LINE_EVENT_RISING_EDGE ? PinEdge::Rising : PinEdge::Falling,
+					 e.timestamp_ns,
+					 e.line_seqno};
+}
+
+bool CDevGpioPinProvider::setEdge(PinEdge edge)
+{
+	uint64_t edgeFlags = 0;
+	if (edge == PinEdge::Rising || edge == PinEdge::Both)
+	{
+		edgeFlags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+	}
+	if (edge == PinEdge::Falling || edge == PinEdge::Both)
+	{
+		edgeFlags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	}
+
+	if (!edgeFlags)
+	{
+		configure(_modeFlags ? _modeFlags : uint64_t{GPIO_V2_LINE_FLAG_INPUT});
+		_edgeFlags = 0;
+		return false;
+	}
+
+	/* Events are reported for inputs only, keep the configured bias */
+	auto inputFlags = (_modeFlags & GPIO_V2_LINE_FLAG_INPUT) ? _modeFlags : uint64_t{GPIO_V2_LINE_FLAG_INPUT};
+	configure(inputFlags | edgeFlags);
+	_modeFlags = inputFlags;
+	_edgeFlags = edgeFlags;
+	return true;
+}
+
+void CDevGpioPinProvider::enableInterrupt(PinEdge edge, _Isr fn)
+{
+	auto& reader = CDevEventReader::instance();
+	if (!setEdge(edge))
+	{
+		reader.remove(_fd);
+		return;
+	}
+
+	reader.add(_fd, [this, fn = std::move(fn)](gpio_v2_line_event const& e) {
+		if (auto event = toEvent(_pin, e); accept(event))
+		{
+			fn(event);
+		}
+	});
+}
+
+int CDevGpioPinProvider::enableEventFd(PinEdge edge)
+{
+	/* The caller reads the line request itself, the reader thread must not */
+	CDevEventReader::instance().remove(_fd);
+	setEdge(edge);
+
+	fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+	return _fd;
+}
+
+std::size_t CDevGpioPinProvider::readEvents(GpioEvent* events, std::size_t count)
+{
+	gpio_v2_line_event batch[CDevEventReader::batchSize];
+
+	std::size_t total = 0;
+	while (total < count)
+	{
+		const auto want = std::min(count - total, CDevEventReader::batchSize);
+		const auto len = ::read(_fd, batch, want * sizeof batch[0]);
+		if (len < static_cast<ssize_t>(sizeof batch[0]))
+		{
+			break;
+		}
+
+		const auto n = static_cast<std::size_t>(len) / sizeof batch[0];
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			if (auto event = toEvent(_pin, batch[i]); accept(event))
+			{
+				events[total++] = event;
+			}
+		}
+		if (n < want)
+		{
+			break;
+		}
+	}
+	return total;
+}
+
+// ---------------------------------------- Port ----------------------------------------
+
+CDevGpioPortProvider::CDevGpioPortProvider(std::shared_ptr<CDevChip> chip, uint64_t pins) :
+	_chip(std::move(chip))
+{
+	for (int offset = 0; pins; ++offset, pins >>= 1)
+	{
+		if (pins & 1)
+		{
+			_offsets.push_back(offset);
+		}
+	}
+	_fd = requestLines(*_chip, _offsets, 0);
+}
+
+CDevGpioPortProvider::~CDevGpioPortProvider()
+{
+	close(_fd);
+}
+
+uint64_t CDevGpioPortProvider::toLines(uint64_t bits) const noexcept
+{
+	uint64_t lines = 0;
+	for (std::size_t i = 0; i < _offsets.size(); ++i)
+	{
+		lines |= ((bits >> _offsets[i]) & 1) << i;
+	}
+	return lines;
+}
+
+uint64_t CDevGpioPortProvider::fromLines(uint64_t lines) const noexcept
+{
+	uint64_t bits = 0;
+	for (std::size_t i = 0; i < _offsets.size(); ++i)
+	{
+		bits |= ((lines >> i) & 1) << _offsets[i];
+	}
+	return bits;
+}
+
+uint64_t CDevGpioPortProvider::read() const
+{
+	gpio_v2_line_values values{0, _offsets.size() == 64 ? ~uint64_t{0} : (uint64_t{1} << _offsets.size()) - 1};
+	if (ioctl(_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+	{
+		throw LLD::ioctl_exception(_fd, "GPIO_V2_LINE_GET_VALUES_IOCTL");
+	}
+	return fromLines(values.bits);
+}
+
+void CDevGpioPortProvider::write(uint64_t mask, uint64_t value)
+{
+	gpio_v2_line_values values{toLines(value), toLines(mask)};
+	if (values.mask == 0)
+	{
+		return;
+	}
+
+	if (ioctl(_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+	{
+		throw LLD::ioctl_exception(_fd, "GPIO_V2_LINE_SET_VALUES_IOCTL");
+	}
+}
+
+void CDevGpioPortProvider::toggle(uint64_t mask)
+{
+	write(mask, ~read());
+}
+
+void CDevGpioPortProvider::setDriveMode(PinDriveMode mode)
+{
+	configureLines(_fd, modeFlags(mode));
+}
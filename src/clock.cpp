@@ -5,15 +5,34 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <iterator>
 
 #include "clock.hpp"
 #include "bcm_host.hpp"
+#include "dmapwmprovider.hpp"
 #include "exceptions.hpp"
 
 
 using namespace Clocks;
 using namespace std::chrono_literals;
 
+/* 0 until known. A debugfs parse or register read at most once per value, PWM users query
+ * these on every update */
+static std::atomic<double> pwmClockRate{0.0};
+static std::atomic<double> sourceRates[8]{};
+
+/* Output of a clock divider, setClock leaves MASH at 0 which ignores the fractional part */
+static double dividedRate(ClockSource source, int divi, int divf, int mash)
+{
+    if (source == ClockSource::Disabled || divi == 0)
+    {
+        return 0.0;
+    }
+    const double divider = mash ? divi + divf / 4096.0 : divi;
+    return Clocks::ClockManager::GetSourceFrequency(source) / divider;
+}
+
 static void setClock(volatile uint32_t& ctl, volatile uint32_t& div, int source, int divi, int divf)
 {
     /* kill the clock if busy, anything else isn't reliable - pigpio.c */
@@ -50,17 +69,90 @@ static void setClock(volatile uint32_t& ctl, volatile uint32_t& div, int source,
                                               std::to_string(fractDiv));
     }
 
-    // TODO: Address multiple pwm controllers
-    auto pwm0 = bcm_pwmPerip(0);
     auto clk = bcm_clkPerip();
 
-    /* Preserve configuration of the PWM */
-    auto cfg = pwm0->CTL;
+    /* Preserve configuration of the PWM controllers, they all run from this clock. CTL goes
+     * through the provider's shadow, so channel updates racing the change are kept as well */
+    using Devices::Pwm::Provider::DMAPwmControllerProvider;
+    const auto controllers = static_cast<int>(bcm_numPwmControllers());
+    for (int i = 0; i < controllers; ++i)
+    {
+        DMAPwmControllerProvider::rewriteCtl(i);
+    }
 
     setClock(clk->PWMCTL, clk->PWMDIV, static_cast<int>(source), integerDiv, fractDiv);
+    pwmClockRate = dividedRate(source, integerDiv, fractDiv, 0);
 
     /* Restore */
-    pwm0->CTL = cfg;
+    for (int i = 0; i < controllers; ++i)
+    {
+        DMAPwmControllerProvider::rewriteCtl(i);
+    }
+}
+
+/* static */ double Clocks::ClockManager::GetPWMClockFrequency()
+{
+    auto rate = pwmClockRate.load(std::memory_order_relaxed);
+    if (rate == 0.0)
+    {
+        auto clk = bcm_clkPerip();
+        const uint32_t ctl = clk->PWMCTL;
+        const uint32_t div = clk->PWMDIV;
+        if (ctl & CLK_CTL_ENAB)
+        {
+            rate = dividedRate(static_cast<ClockSource>(ctl & 0xf), (div >> 12) & 0xfff, div & 0xfff, (ctl >> 9) & 0x3);
+            pwmClockRate.store(rate, std::memory_order_relaxed);
+        }
+    }
+    return rate;
+}
+
+/* static */ double Clocks::ClockManager::GetSourceFrequency(ClockSource source)
+{
+    struct source_t
+    {
+        ClockSource source;
+        const char* name;
+        double nominal[2];  /* BCM2835, BCM2711 */
+    };
+    static constexpr source_t sources[] = {
+        {ClockSource::Oscillator,    "osc",      {19.2e6, 54e6}},
+        {ClockSource::PLLA,          "plla_per", {0.0,    0.0}},
+        {ClockSource::PLLC,          "pllc_per", {1.2e9,  1e9}},
+        {ClockSource::PLLD,          "plld_per", {500e6,  750e6}},
+        {ClockSource::HDMIAuxiliary, "pllh_aux", {216e6,  216e6}},
+    };
+
+    const auto index = static_cast<std::size_t>(source);
+    if (index >= std::size(sourceRates))
+    {
+        return 0.0;
+    }
+
+    auto& cached = sourceRates[index];
+    if (auto rate = cached.load(std::memory_order_relaxed); rate != 0.0)
+    {
+        return rate;
+    }
+
+    for (auto const& s : sources)
+    {
+        if (s.source == source)
+        {
+            double rate;
+            try
+            {
+                rate = static_cast<double>(GetClockFrequency(s.name));
+            }
+            catch (LLD::lowleveldevices_exception const&)
+            {
+                rate = s.nominal[bcm_getSoc() == bcm_soc::BCM2711 ? 1 : 0];
+            }
+            cached.store(rate, std::memory_order_relaxed);
+            return rate;
+        }
+    }
+    return 0.0;
 }
 
 /* static */ void Clocks::ClockManager::SetPCMClock(ClockSource source, int integerDiv, int fractDiv)
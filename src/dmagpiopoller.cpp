@@ -0,0 +1,770 @@
+#include "dmagpiopoller.hpp"
+#include "bcm_host.hpp"
+#include "threadpolicy.hpp"
+#include "exceptions.hpp"
+#include <algorithm>
+
+#ifndef DMA_POLLING_ACCURACY
+#define DMA_POLLING_ACCURACY 100
+#endif
+
+using namespace Devices;
+using namespace Devices::Gpio;
+using namespace Devices::Gpio::Provider;
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+static PinEdge combine(PinEdge a, PinEdge b)
+{
+	if (a == PinEdge::None || a == b)
+	{
+		return b;
+	}
+	return b == PinEdge::None ? a : PinEdge::Both;
+}
+
+static bool matches(PinEdge wanted, PinEdge edge)
+{
+	return wanted == edge || wanted == PinEdge::Both;
+}
+
+/* Nanoseconds on the steady clock, the time base of timestamps and deadlines */
+static uint64_t nanoseconds(std::chrono::steady_clock::time_point when)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+}
+
+// --------------------------------------------------------------------------------------
+
+/* static */ DMAGpioPoller& DMAGpioPoller::instance()
+{
+	static DMAGpioPoller poller;
+	return poller;
+}
+
+DMAGpioPoller::DMAGpioPoller() :
+	_regs(bcm_gpioPerip()),
+	_policy{std::chrono::microseconds{0},
+			std::chrono::microseconds{DMA_POLLING_ACCURACY},
+			std::chrono::microseconds{DMA_POLLING_ACCURACY}}
+{
+	/* Room for every rule firing a few times within one delay, so the poller never allocates */
+	_delayed.reserve(maxReflexes * 8);
+}
+
+DMAGpioPoller::~DMAGpioPoller()
+{
+	_armed = 0;
+	_reflexPins = 0;
+	_wake.notify_all();
+
+	if (_thread.joinable())
+	{
+		_thread.join();
+	}
+
+	for (auto& slot : _handlers)
+	{
+		delete slot.load();
+	}
+	for (auto handler : _retired)
+	{
+		delete handler;
+	}
+	for (auto& slot : _reflexes)
+	{
+		delete slot.load();
+	}
+}
+
+void DMAGpioPoller::arm(int pin, PinEdge edge, _Isr fn)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+
+	_filterReset.fetch_or(uint64_t{1} << pin);
+	_levelPins.fetch_and(~(uint64_t{1} << pin));
+	retire(_handlers[pin].exchange(new handler_t{std::move(fn), edge, nullptr}, std::memory_order_acq_rel));
+	program(pin);
+
+	if (_armed.fetch_or(uint64_t{1} << pin) == 0)
+	{
+		start();
+	}
+}
+
+void DMAGpioPoller::armLevels(int pin, _LevelIsr fn)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+
+	/* Set first, the poller must never take the new handler for a filtered one */
+	_levelPins.fetch_or(uint64_t{1} << pin);
+	retire(_handlers[pin].exchange(new handler_t{nullptr, PinEdge::Both, std::move(fn)}, std::memory_order_acq_rel));
+	program(pin);
+
+	if (_armed.fetch_or(uint64_t{1} << pin) == 0)
+	{
+		start();
+	}
+}
+
+void DMAGpioPoller::setFilter(int pin, PinFilter const& filter)
+{
+	const auto glitch = std::chrono::duration_cast<std::chrono::nanoseconds>(filter.glitch).count();
+	const auto debounce = std::chrono::duration_cast<std::chrono::nanoseconds>(filter.debounce).count();
+
+	std::lock_guard<std::mutex> guard(_lock);
+
+	_glitch[pin] = glitch > 0 ? glitch : 0;
+	_debounce[pin] = debounce > 0 ? debounce : 0;
+	if (glitch > 0 || debounce > 0)
+	{
+		_filtered.fetch_or(uint64_t{1} << pin);
+	}
+	else
+	{
+		_filtered.fetch_and(~(uint64_t{1} << pin));
+	}
+	_filterReset.fetch_or(uint64_t{1} << pin);
+
+	program(pin);
+}
+
+void DMAGpioPoller::disarm(int pin)
+{
+	const auto bank = pin / 32;
+	const uint32_t bit = 1u << (pin % 32);
+
+	std::thread::id poller;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+
+		/* The poller notices on its own, but it may be sleeping for a while */
+		if (_armed.fetch_and(~(uint64_t{1} << pin)) == (uint64_t{1} << pin) && _reflexPins == 0)
+		{
+			_wake.notify_one();
+		}
+		retire(_handlers[pin].exchange(nullptr));
+		_levelPins.fetch_and(~(uint64_t{1} << pin));
+
+		/* Rules triggered by the pin keep their edges */
+		program(pin);
+		if (!(_reflexPins & (uint64_t{1} << pin)))
+		{
+			bcm_gpioClearEvents(bank, bit);
+		}
+		poller = _thread.get_id();
+	}
+
+	/* The handler may still be running for a round dispatched before, unless that is us */
+	if (auto round = _round.load(); (round & 1) && poller != std::this_thread::get_id())
+	{
+		while (_round.load() == round)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+int DMAGpioPoller::addReflex(ReflexRule const& rule)
+{
+	constexpr uint64_t pins = (uint64_t{1} << pinCount) - 1;
+	if (rule.trigger == 0 || (rule.trigger & ~pins))
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::Provider::DMAGpioPoller::addReflex()",
+											  "trigger pins within 0-53",
+											  std::to_string(rule.trigger));
+	}
+	if ((rule.set | rule.clear) & ~pins)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::Provider::DMAGpioPoller::addReflex()",
+											  "set and clear pins within 0-53",
+											  std::to_string(rule.set | rule.clear));
+	}
+	if (rule.edge == PinEdge::None)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::Provider::DMAGpioPoller::addReflex()",
+											  "Rising, Falling or Both",
+											  "None");
+	}
+	if (rule.delay.count() < 0)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::Provider::DMAGpioPoller::addReflex()",
+											  "delay >= 0",
+											  std::to_string(rule.delay.count()));
+	}
+
+	std::lock_guard<std::mutex> guard(_lock);
+
+	auto slot = std::find_if(_reflexes.begin(), _reflexes.end(), [](auto& s){ return s.load() == nullptr; });
+	if (slot == _reflexes.end())
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::Provider::DMAGpioPoller::addReflex()",
+											  "at most " + std::to_string(maxReflexes) + " rules",
+											  std::to_string(maxReflexes + 1));
+	}
+
+	auto r = new rule_t;
+	r->trigger = rule.trigger;
+	r->edge = rule.edge;
+	r->set = rule.set;
+	r->clear = rule.clear;
+	r->delay = std::chrono::duration_cast<std::chrono::nanoseconds>(rule.delay).count();
+
+	/* The rule is in place before the poller looks at its trigger pins */
+	slot->store(r);
+	for (auto trigger = rule.trigger; trigger; trigger &= trigger - 1)
+	{
+		const int pin = __builtin_ctzll(trigger);
+		_reflexEdge[pin] = combine(_reflexEdge[pin], rule.edge);
+		program(pin);
+	}
+
+	if ((_armed | _reflexPins.fetch_or(rule.trigger)) == 0)
+	{
+		start();
+	}
+	return static_cast<int>(slot - _reflexes.begin());
+}
+
+void DMAGpioPoller::removeReflex(int id)
+{
+	if (id < 0 || id >= maxReflexes)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::Provider::DMAGpioPoller::removeReflex()",
+											  "0 <= id < " + std::to_string(maxReflexes),
+											  std::to_string(id));
+	}
+
+	rule_t* r;
+	std::thread::id poller;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+
+		r = _reflexes[id].exchange(nullptr);
+		if (!r)
+		{
+			return;
+		}
+
+		/* Rebuild what the remaining rules need detected */
+		uint64_t triggers = 0;
+		_reflexEdge.fill(PinEdge::None);
+		for (auto& slot : _reflexes)
+		{
+			if (auto other = slot.load())
+			{
+				triggers |= other->trigger;
+				for (auto trigger = other->trigger; trigger; trigger &= trigger - 1)
+				{
+					const int pin = __builtin_ctzll(trigger);
+					_reflexEdge[pin] = combine(_reflexEdge[pin], other->edge);
+				}
+			}
+		}
+
+		_reflexPins = triggers;
+		for (auto trigger = r->trigger; trigger; trigger &= trigger - 1)
+		{
+			const int pin = __builtin_ctzll(trigger);
+			program(pin);
+			if (!((_armed | triggers) & (uint64_t{1} << pin)))
+			{
+				bcm_gpioClearEvents(pin / 32, 1u << (pin % 32));
+			}
+		}
+
+		if ((_armed | triggers) == 0)
+		{
+			_wake.notify_one();
+		}
+		poller = _thread.get_id();
+	}
+
+	/* Same as disarm(), the rule may be evaluated by the round in progress. A handler removing
+	 * a rule runs after the rules of its round were applied */
+	if (auto round = _round.load(); (round & 1) && poller != std::this_thread::get_id())
+	{
+		while (_round.load() == round)
+		{
+			std::this_thread::yield();
+		}
+	}
+	delete r;
+}
+
+uint64_t DMAGpioPoller::reflexCount(int id) const noexcept
+{
+	if (id < 0 || id >= maxReflexes)
+	{
+		return 0;
+	}
+	auto r = _reflexes[id].load();
+	return r ? r->fired.load(std::memory_order_relaxed) : 0;
+}
+
+void DMAGpioPoller::setPollingPolicy(PollingPolicy const& policy)
+{
+	{
+		std::lock_guard<std::mutex> guard(_stateLock);
+		_policy = policy;
+		_policyChanged = true;
+	}
+	_wake.notify_one();
+}
+
+PollingPolicy DMAGpioPoller::getPollingPolicy()
+{
+	std::lock_guard<std::mutex> guard(_stateLock);
+	return _policy;
+}
+
+// --------------------------------------------------------------------------------------
+
+void DMAGpioPoller::start()
+{
+	/* Called with _lock held, whenever the first pin gets armed or the first rule added */
+	std::lock_guard<std::mutex> guard(_stateLock);
+	if (_running)
+	{
+		/* Still running, or a handler on the poll thread re-armed a pin */
+		return;
+	}
+
+	/* The previous thread has left its loop already, it only has to be collected */
+	if (_thread.joinable())
+	{
+		_thread.join();
+	}
+
+	for (auto handler : _retired)
+	{
+		delete handler;
+	}
+	_retired.clear();
+	_pendingReclaim = false;
+
+	_running = true;
+	_thread = LibraryThreads::spawn(&DMAGpioPoller::run, this);
+}
+
+void DMAGpioPoller::program(int pin)
+{
+	/* Called with _lock held. Filters follow the level, they need to see both edges */
+	const auto bank = pin / 32;
+	const uint32_t bit = 1u << (pin % 32);
+	const auto mask = uint64_t{1} << pin;
+
+	auto edge = PinEdge::None;
+	if (auto handler = _handlers[pin].load())
+	{
+		edge = _filtered & mask ? PinEdge::Both : handler->edge;
+	}
+	edge = combine(edge, _reflexEdge[pin]);
+
+	if (edge == PinEdge::Rising || edge == PinEdge::Both)
+	{
+		_regs->GPREN[bank] |= bit;
+	}
+	else
+	{
+		_regs->GPREN[bank] &= ~bit;
+	}
+
+	if (edge == PinEdge::Falling || edge == PinEdge::Both)
+	{
+		_regs->GPFEN[bank] |= bit;
+	}
+	else
+	{
+		_regs->GPFEN[bank] &= ~bit;
+	}
+
+	edge == PinEdge::Rising ? _risingOnly.fetch_or(mask) : _risingOnly.fetch_and(~mask);
+	edge == PinEdge::Falling ? _fallingOnly.fetch_or(mask) : _fallingOnly.fetch_and(~mask);
+	edge == PinEdge::Both ? _bothEdges.fetch_or(mask) : _bothEdges.fetch_and(~mask);
+}
+
+void DMAGpioPoller::retire(handler_t* handler)
+{
+	if (!handler)
+	{
+		return;
+	}
+
+	if (!_running)
+	{
+		delete handler;
+		return;
+	}
+
+	_retired.push_back(handler);
+	_pendingReclaim = true;
+}
+
+void DMAGpioPoller::reclaim()
+{
+	/* Called between dispatch rounds, no handler retired so far can still be in use */
+	if (_pendingReclaim && _lock.try_lock())
+	{
+		for (auto handler : _retired)
+		{
+			delete handler;
+		}
+		_retired.clear();
+		_pendingReclaim = false;
+		_lock.unlock();
+	}
+}
+
+uint64_t DMAGpioPoller::reflex(uint64_t rising, uint64_t falling, uint64_t now)
+{
+	/* Rules firing together are merged, one store per register and bank */
+	uint64_t set = 0, clear = 0;
+	for (auto& slot : _reflexes)
+	{
+		if (!(rising | falling))
+		{
+			break;
+		}
+
+		auto r = slot.load();
+		if (!r)
+		{
+			continue;
+		}
+
+		const auto fired = (matches(r->edge, PinEdge::Rising) ? rising : 0) |
+						   (matches(r->edge, PinEdge::Falling) ? falling : 0);
+		if (!(fired & r->trigger))
+		{
+			continue;
+		}
+
+		r->fired.fetch_add(1, std::memory_order_relaxed);
+		if (r->delay == 0)
+		{
+			set |= r->set;
+			clear |= r->clear;
+		}
+		else if (_delayed.size() < _delayed.capacity())
+		{
+			_delayed.push_back(delayed_t{now + r->delay, r->set, r->clear});
+		}
+		else
+		{
+			/* Late is better than never */
+			set |= r->set;
+			clear |= r->clear;
+		}
+	}
+
+	drive(set, clear);
+	return delayed(now);
+}
+
+uint64_t DMAGpioPoller::delayed(uint64_t now)
+{
+	/* Due stores are applied in the order they were queued, returns the next due time */
+	uint64_t next = 0;
+	auto kept = _delayed.begin();
+	for (auto& d : _delayed)
+	{
+		if (d.due <= now)
+		{
+			drive(d.set, d.clear);
+			continue;
+		}
+		next = next ? std::min(next, d.due) : d.due;
+		*kept++ = d;
+	}
+	_delayed.erase(kept, _delayed.end());
+	return next;
+}
+
+void DMAGpioPoller::drive(uint64_t set, uint64_t clear)
+{
+	/* A pin in both masks ends up high */
+	if (auto bits = static_cast<uint32_t>(clear))
+	{
+		_regs->GPCLR[0] = bits;
+	}
+	if (auto bits = static_cast<uint32_t>(clear >> 32))
+	{
+		_regs->GPCLR[1] = bits;
+	}
+	if (auto bits = static_cast<uint32_t>(set))
+	{
+		_regs->GPSET[0] = bits;
+	}
+	if (auto bits = static_cast<uint32_t>(set >> 32))
+	{
+		_regs->GPSET[1] = bits;
+	}
+}
+
+void DMAGpioPoller::dispatch(uint64_t rising, uint64_t falling, uint64_t levels, uint64_t timestamp)
+{
+	/* Visit the fired pins only, lowest pin first */
+	for (auto events = rising | falling; events; events &= events - 1)
+	{
+		const int pin = __builtin_ctzll(events);
+		const auto edge = (rising >> pin) & 1 ? PinEdge::Rising : PinEdge::Falling;
+
+		/* Sequentially consistent with disarm(), which checks _round after clearing the slot */
+		auto handler = _handlers[pin].load();
+		if (!handler)
+		{
+			continue;
+		}
+
+		if (handler->levels)
+		{
+			handler->levels(levels, timestamp);
+		}
+		else if (matches(handler->edge, edge))
+		{
+			handler->fn(GpioEvent{pin, edge, timestamp, ++_sequence[pin]});
+		}
+	}
+}
+
+uint64_t DMAGpioPoller::filter(uint64_t events, uint64_t filtered, uint64_t levels, uint64_t now)
+{
+	if (_filterReset.load(std::memory_order_relaxed))
+	{
+		for (auto reset = _filterReset.exchange(0); reset; reset &= reset - 1)
+		{
+			_filterState[__builtin_ctzll(reset)] = filter_state_t{};
+		}
+	}
+
+	/* Pins whose filter went away in the meantime are simply forgotten */
+	_active &= filtered;
+
+	uint64_t deadline = 0;
+	for (auto pins = events | _active; pins; pins &= pins - 1)
+	{
+		const int pin = __builtin_ctzll(pins);
+		const bool level = (levels >> pin) & 1;
+		const auto glitch = _glitch[pin].load(std::memory_order_relaxed);
+		const auto debounce = _debounce[pin].load(std::memory_order_relaxed);
+		auto& st = _filterState[pin];
+
+		if ((events >> pin) & 1)
+		{
+			if (glitch)
+			{
+				/* A new candidate supersedes the one still waiting */
+				if (st.pending)
+				{
+					_suppressed[pin].fetch_add(1, std::memory_order_relaxed);
+				}
+				st.pending = true;
+				st.candidate = level;
+				st.since = now;
+			}
+			else
+			{
+				pass(pin, level, now);
+			}
+		}
+
+		if (st.pending && now - st.since >= glitch)
+		{
+			st.pending = false;
+			if (level == st.candidate)
+			{
+				pass(pin, level, st.since);
+			}
+			else
+			{
+				_suppressed[pin].fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		if (st.trailing && now >= st.lockUntil && !st.pending)
+		{
+			st.trailing = false;
+			if (level != st.reported)
+			{
+				report(pin, level, now);
+				st.lockUntil = now + debounce;
+			}
+		}
+
+		/* Keep visiting the pin while a deadline is ahead */
+		uint64_t next = 0;
+		if (st.pending)
+		{
+			next = st.since + glitch;
+		}
+		else if (st.trailing)
+		{
+			next = st.lockUntil;
+		}
+
+		if (next)
+		{
+			_active |= uint64_t{1} << pin;
+			deadline = deadline ? std::min(deadline, next) : next;
+		}
+		else
+		{
+			_active &= ~(uint64_t{1} << pin);
+		}
+	}
+	return deadline;
+}
+
+void DMAGpioPoller::pass(int pin, bool level, uint64_t timestamp)
+{
+	/* Edge that made it through the glitch stage, on to the debounce stage */
+	auto& st = _filterState[pin];
+	if (!st.valid)
+	{
+		st.valid = true;
+		st.reported = !level;
+	}
+
+	if (level == st.reported)
+	{
+		/* Pulse that came and went between two polls */
+		_suppressed[pin].fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	if (timestamp < st.lockUntil)
+	{
+		st.trailing = true;
+		_suppressed[pin].fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	report(pin, level, timestamp);
+	st.lockUntil = timestamp + _debounce[pin].load(std::memory_order_relaxed);
+}
+
+void DMAGpioPoller::report(int pin, bool level, uint64_t timestamp)
+{
+	_filterState[pin].reported = level;
+
+	const auto edge = level ? PinEdge::Rising : PinEdge::Falling;
+	/* The pin may have switched to a level handler since the filter was chosen */
+	if (auto handler = _handlers[pin].load(); handler && handler->fn && matches(handler->edge, edge))
+	{
+		handler->fn(GpioEvent{pin, edge, timestamp, ++_sequence[pin]});
+	}
+}
+
+void DMAGpioPoller::run()
+{
+	using clock = std::chrono::steady_clock;
+
+	PollingPolicy policy = getPollingPolicy();
+	auto sleep = policy.minSleep;
+	auto lastEvent = clock::now();
+
+	for (;;)
+	{
+		reclaim();
+
+		const uint64_t armed = _armed.load(std::memory_order_acquire);
+		const uint64_t reflexPins = _reflexPins.load(std::memory_order_acquire);
+		if ((armed | reflexPins) == 0 && _delayed.empty())
+		{
+			/* Decided under the lock, so start() either sees us running or can join us */
+			std::lock_guard<std::mutex> guard(_stateLock);
+			if ((_armed | _reflexPins) == 0)
+			{
+				_running = false;
+				return;
+			}
+			continue;
+		}
+
+		const uint64_t events = (_regs->GPEDS[0] | uint64_t{_regs->GPEDS[1]} << 32) & (armed | reflexPins);
+		if (events)
+		{
+			if (auto bits = static_cast<uint32_t>(events))
+			{
+				bcm_gpioClearEvents(0, bits);
+			}
+			if (auto bits = static_cast<uint32_t>(events >> 32))
+			{
+				bcm_gpioClearEvents(1, bits);
+			}
+		}
+
+		/* Filtered pins are visited on their own deadlines too, not only on events */
+		const uint64_t filtered = _filtered.load(std::memory_order_relaxed) & armed & ~_levelPins.load(std::memory_order_relaxed);
+		uint64_t deadline = 0;
+		auto now = clock::now();
+
+		if (events || (_active & filtered) || !_delayed.empty())
+		{
+			const auto levels = _regs->GPLEV[0] | uint64_t{_regs->GPLEV[1]} << 32;
+			const auto timestamp = nanoseconds(now);
+
+			/* Which edge a bit stands for, Both pins tell by the level sampled after the poll */
+			const auto both = _bothEdges.load(std::memory_order_relaxed);
+			const auto rising = events & (_risingOnly.load(std::memory_order_relaxed) | (both & levels));
+			const auto falling = events & (_fallingOnly.load(std::memory_order_relaxed) | (both & ~levels));
+
+			++_round;
+			deadline = reflex(rising & reflexPins, falling & reflexPins, timestamp);
+			dispatch(rising & armed & ~filtered, falling & armed & ~filtered, levels, timestamp);
+			if (filtered)
+			{
+				const auto next = filter(events & filtered, filtered, levels, timestamp);
+				deadline = deadline && next ? std::min(deadline, next) : deadline | next;
+			}
+			++_round;
+		}
+		else
+		{
+			_active &= filtered;
+		}
+
+		if (events)
+		{
+			lastEvent = now;
+			sleep = policy.minSleep;
+			continue;
+		}
+
+		if (policy.spinWindow.count() > 0 && clock::now() - lastEvent < policy.spinWindow)
+		{
+			cpuRelax();
+			continue;
+		}
+
+		/* Idle, back off exponentially until an event, a new policy or the last pin leaving wakes us */
+		auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(sleep);
+		if (deadline)
+		{
+			const auto left = std::chrono::nanoseconds{deadline} - now.time_since_epoch();
+			wait = std::max(std::chrono::nanoseconds{0}, std::min(wait, left));
+		}
+
+		std::unique_lock<std::mutex> guard(_stateLock);
+		_wake.wait_for(guard, wait, [this]{ return _policyChanged || ((_armed | _reflexPins) == 0 && _delayed.empty()); });
+
+		if (_policyChanged)
+		{
+			_policyChanged = false;
+			policy = _policy;
+			sleep = policy.minSleep;
+		}
+		else
+		{
+			sleep = std::min(sleep * 2, policy.maxSleep);
+		}
+	}
+}
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <array>
 #include <functional>
+#include <stdexcept>
 
 #include <thread>
 #include <chrono>
@@ -20,10 +21,6 @@ using namespace Devices::Gpio::Provider;
 
 // --------------------------------------------------------------------------------------
 
-/* static */ DMAGpioPinProvider::poll DMAGpioPinProvider::_poll{};
-
-// --------------------------------------------------------------------------------------
-
 DMAGpioProvider* DMAGpioProvider::getInstance() noexcept
 {
 	static DMAGpioProvider _provider;
@@ -64,6 +61,16 @@ IGpioPinProvider* DMAGpioControllerProvider::open(int pin)
 	return new DMAGpioPinProvider(pin);
 }
 
+IGpioPortProvider* DMAGpioControllerProvider::openPort(uint64_t pins)
+{
+	if (pins >> count())
+	{
+		throw std::range_error("\'pins\' mask exceeds the controller.");
+	}
+
+	return new DMAGpioPortProvider(pins);
+}
+
 int DMAGpioControllerProvider::base() const
 {
 	return 0;
@@ -71,7 +78,7 @@ int DMAGpioControllerProvider::base() const
 
 int DMAGpioControllerProvider::count() const
 {
-	return 53;
+	return 54;
 }
 
 std::string DMAGpioControllerProvider::name() const
@@ -81,29 +88,28 @@ std::string DMAGpioControllerProvider::name() const
 
 // --------------------------------------------------------------------------------------
 
+DMAGpioPinProvider::DMAGpioPinProvider(int pin) :
+	_pin(pin), _pinBank(pin/32), _pinBit(1 << (pin % 32)),
+	_regs(bcm_gpioPerip()),
+	_set(&_regs->GPSET[_pinBank]),
+	_clr(&_regs->GPCLR[_pinBank]),
+	_lev(&_regs->GPLEV[_pinBank])
+{
+}
+
 PinValue DMAGpioPinProvider::read() const
 {
-    if (bcm_gpioPerip()->GPLEV[_pinBank] & _pinBit)
-    {
-        return PinValue::High;
-    }
-    else
-    {
-        return PinValue::Low;
-    }
+    return (*_lev & _pinBit) ? PinValue::High : PinValue::Low;
 }
 
 void DMAGpioPinProvider::write(PinValue val)
 {
-	if (val == PinValue::High)
-	{
-		bcm_gpioPerip()->GPSET[_pinBank] = _pinBit;
-	}
-	else
-	{
-		bcm_gpioPerip()->GPCLR[_pinBank] = _pinBit;
-	}
+	*(val == PinValue::High ? _set : _clr) = _pinBit;
 }
+/* Function select bits of ALT0 to ALT5 */
+static constexpr std::array<uint8_t, 6> altBits = {0b100, 0b101, 0b110, 0b111, 0b011, 0b010};
+
+/* PWM functions come from bcm_pwmRoute(), they differ between SoCs */
 static const std::map<int, std::vector<std::pair<uint8_t,PinDriveMode>>> altMap =
 {
     {4, {
@@ -116,19 +122,6 @@ static const std::map<int, std::vector<std::pair<uint8_t,PinDriveMode>>> altMap
         {0, PinDriveMode::Clock}    /* GPCLK2 */
     }},
 
-    {12, {
-        {0, PinDriveMode::Pwm}  /* PWM0_0 */
-    }},
-    {13, {
-        {0, PinDriveMode::Pwm}  /* PWM0_1 */
-    }},
-
-    {18, {
-        {5, PinDriveMode::Pwm}  /* PWM0_0 */
-    }},
-    {19, {
-        {5, PinDriveMode::Pwm}  /* PWM0_1 */
-    }},
     {20, {
         {5, PinDriveMode::Clock}    /* GPCLK0 */
     }},
@@ -143,12 +136,6 @@ static const std::map<int, std::vector<std::pair<uint8_t,PinDriveMode>>> altMap
         {0, PinDriveMode::Clock}    /* GPCLK0 */
     }},
 
-    {40, {
-         {0, PinDriveMode::Pwm}     /* PWM1_0 */
-    }},
-    {41, {
-         {0, PinDriveMode::Pwm}     /* PWM1_1 */
-    }},
     {42, {
          {0, PinDriveMode::Clock}   /* GPCLK1 */
     }},
@@ -158,14 +145,10 @@ static const std::map<int, std::vector<std::pair<uint8_t,PinDriveMode>>> altMap
     {44, {
          {0, PinDriveMode::Clock}   /* GPCLK1 */
     }},
-    {45, {
-         {0, PinDriveMode::Pwm}     /* PWM0_1 */
-    }},
 };
 PinDriveMode DMAGpioPinProvider::getDriveMode() const
 {
-    auto mode = bcm_gpioPerip()->GPFSEL[_pin / 10] & (0x7 << (_pin % 10));
-    mode >>= (_pin % 10);
+    auto mode = (_regs->GPFSEL[_pin / 10] >> (3 * (_pin % 10))) & 0x7;
 
     switch (mode)
     {
@@ -176,6 +159,10 @@ PinDriveMode DMAGpioPinProvider::getDriveMode() const
         return PinDriveMode::Output;
 
     default:
+        if (bcm_pwm_route route{}; bcm_pwmRoute(_pin, &route) && altBits[route.alt] == mode)
+        {
+            return PinDriveMode::Pwm;
+        }
         if (altMap.find(_pin) != altMap.end())
         if (auto item = std::find_if(altMap.at(_pin).begin(), altMap.at(_pin).end(),
                                      [mode](auto pair){return pair.first == mode;}); item != altMap.at(_pin).end())
@@ -188,25 +175,24 @@ PinDriveMode DMAGpioPinProvider::getDriveMode() const
 
 void DMAGpioPinProvider::setDriveMode(PinDriveMode mode)
 {
-    constexpr auto setFS = [](int pin, int val){
+    auto setFS = [this](int pin, int val){
         const auto bank = pin/10;
         const auto offset = (3 * (pin % 10));
 
-        auto ptr = bcm_gpioPerip();
+        auto ptr = _regs;
         ptr->GPFSEL[bank] &= ~(0x7 << offset);
         ptr->GPFSEL[bank] |= val << offset;
     };
     auto setPU = [this](bool up, bool down){
-        auto ptr = bcm_gpioPerip();
+        auto ptr = _regs;
 
         ptr->GPPUD = (up ? 0b10 : 0) | (down ? 0b01 : 0);
         std::this_thread::sleep_for(std::chrono::nanoseconds(150));
         ptr->GPPUDCLK[_pinBank] = _pinBit;
         std::this_thread::sleep_for(std::chrono::nanoseconds(150));
-        ptr->GPPUDCLK[_pinBank] = _pinBit;
         ptr->GPPUD = 0;
+        ptr->GPPUDCLK[_pinBank] = 0;
     };
-    static constexpr std::array<uint8_t, 6> altBits = {0b100, 0b101, 0b110, 0b111, 0b011, 0b010};
 
 	switch (mode)
 	{
@@ -230,8 +216,15 @@ void DMAGpioPinProvider::setDriveMode(PinDriveMode mode)
 		setFS(_pin, 0b001);
 		break;
 
-    case PinDriveMode::Clock:
     case PinDriveMode::Pwm:
+        if (bcm_pwm_route route{}; bcm_pwmRoute(_pin, &route))
+        {
+            setFS(_pin, altBits[route.alt]);
+            break;
+        }
+        throw LLD::not_supported_exception{};
+
+    case PinDriveMode::Clock:
         if (altMap.find(_pin) != altMap.end())
         if (auto item = std::find_if(altMap.at(_pin).begin(), altMap.at(_pin).end(),
                                      [mode](auto pair){return pair.second == mode;}); item != altMap.at(_pin).end())
@@ -247,76 +240,123 @@ void DMAGpioPinProvider::setDriveMode(PinDriveMode mode)
 	}
 }
 
+// --------------------------------------------------------------------------------------
+
+DMAGpioPortProvider::DMAGpioPortProvider(uint64_t pins) :
+	_pins(pins),
+	_low(static_cast<uint32_t>(pins) != 0),
+	_high((pins >> 32) != 0),
+	_regs(bcm_gpioPerip())
+{
+}
+
+uint64_t DMAGpioPortProvider::read() const
+{
+	uint64_t lev = 0;
+	if (_low)
+	{
+		lev |= _regs->GPLEV[0];
+	}
+	if (_high)
+	{
+		lev |= uint64_t{_regs->GPLEV[1]} << 32;
+	}
+	return lev & _pins;
+}
+
+void DMAGpioPortProvider::write(uint64_t mask, uint64_t value)
+{
+	mask &= _pins;
+	const uint64_t set = value & mask;
+	const uint64_t clr = ~value & mask;
+
+	if (auto bits = static_cast<uint32_t>(set))
+	{
+		_regs->GPSET[0] = bits;
+	}
+	if (auto bits = static_cast<uint32_t>(set >> 32))
+	{
+		_regs->GPSET[1] = bits;
+	}
+	if (auto bits = static_cast<uint32_t>(clr))
+	{
+		_regs->GPCLR[0] = bits;
+	}
+	if (auto bits = static_cast<uint32_t>(clr >> 32))
+	{
+		_regs->GPCLR[1] = bits;
+	}
+}
+
+void DMAGpioPortProvider::toggle(uint64_t mask)
+{
+	write(mask, ~read());
+}
+
+void DMAGpioPortProvider::setDriveMode(PinDriveMode mode)
+{
+	for (int pin = 0; pin < 64; ++pin)
+	{
+		if (_pins & (uint64_t{1} << pin))
+		{
+			DMAGpioPinProvider(pin).setDriveMode(mode);
+		}
+	}
+}
+
+
 // ------------------------ Interrupt handling -----------------------
 
 void DMAGpioPinProvider::enableInterrupt(PinEdge edge, _Isr fn)
 {
-    auto ptr = bcm_gpioPerip();
     if (edge == PinEdge::None)
     {
-        ptr->GPREN[_pinBank] &= ~_pinBit;
-        ptr->GPFEN[_pinBank] &= ~_pinBit;
-
-        /* Detach interrupt */
-        auto it = _poll.map.find(pinNumber());
-        if (it != _poll.map.end())
-        {
-            _poll.map.erase(it);
-        }
-
-        if (_poll.map.empty())
-        {
-            _poll.running = false;
-            _poll.instance.join();
-        }
-        return;
+        DMAGpioPoller::instance().disarm(_pin);
+        _armed = false;
     }
-    else if (edge == PinEdge::Falling)
+    else
     {
-        ptr->GPREN[_pinBank] &= ~_pinBit;
-        ptr->GPFEN[_pinBank] |= _pinBit;
+        DMAGpioPoller::instance().arm(_pin, edge, std::move(fn));
+        _armed = true;
     }
-    else if (edge == PinEdge::Rising)
+}
+
+bool DMAGpioPinProvider::enableLevelInterrupt(_LevelIsr fn)
+{
+    if (!fn)
     {
-        ptr->GPREN[_pinBank] |= _pinBit;
-        ptr->GPFEN[_pinBank] &= ~_pinBit;
+        DMAGpioPoller::instance().disarm(_pin);
+        _armed = false;
     }
     else
     {
-        ptr->GPREN[_pinBank] |= _pinBit;
-        ptr->GPFEN[_pinBank] |= _pinBit;
+        DMAGpioPoller::instance().armLevels(_pin, std::move(fn));
+        _armed = true;
     }
+    return true;
+}
+
+void DMAGpioPinProvider::setFilter(PinFilter const& filter)
+{
+    DMAGpioPoller::instance().setFilter(_pin, filter);
+    _filtered = filter.glitch.count() > 0 || filter.debounce.count() > 0;
+}
 
-    if (!_poll.instance.joinable() && !_poll.map.empty())
+uint64_t DMAGpioPinProvider::suppressedEdges() const noexcept
+{
+    return DMAGpioPoller::instance().suppressed(_pin);
+}
+
+DMAGpioPinProvider::~DMAGpioPinProvider()
+{
+    /* The handler may refer to the pin that owns us */
+    if (_armed)
     {
-        _poll.map[pinNumber()] = std::move(fn);
-        _poll.instance = std::thread([]{
-            auto ptr = bcm_gpioPerip();
-            while (_poll.running)
-            {
-                auto evt = ptr->GPEDS[0] + (ptr->GPEDS[1] * 4294967296ll);
-                int offset = 0;
-                while (evt && _poll.running)
-                {
-                    if (evt & 1 && _poll.map.find(offset) != _poll.map.end())
-                    {
-                        std::invoke(
-                                _poll.map[offset],
-                                (ptr->GPLEV[offset/32] & (offset % 32)) ? PinEdge::Rising : PinEdge::Falling);
-                    }
-
-                    ++offset;
-                    evt >>= 1;
-                }
-
-                std::this_thread::sleep_for(_poll.pollingAccuracy);
-            }
-        });
+        DMAGpioPoller::instance().disarm(_pin);
     }
-    else
+    /* The next owner of the pin starts unfiltered */
+    if (_filtered)
     {
-        /* Even if entry already exists, we want to override isr */
-        _poll.map[pinNumber()] = fn;
+        DMAGpioPoller::instance().setFilter(_pin, PinFilter{});
     }
 }
-
@@ -5,6 +5,11 @@
 #include "dmapwmprovider.hpp"
 #include "bcm_host.hpp"
 
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <stdexcept>
 
@@ -12,15 +17,99 @@ using namespace Devices;
 using namespace Devices::Pwm;
 using namespace Devices::Pwm::Provider;
 
+namespace
+{
+/* Software copy of the registers of a controller, loaded from the hardware on first use. Only
+ * the library is expected to change them afterwards */
+struct shadow_t
+{
+    std::once_flag loaded;
+    std::atomic<uint32_t> ctl{0};
+    std::atomic<uint32_t> rng[2]{};
+    std::atomic<uint32_t> dat[2]{};
+};
+}
+
+static shadow_t& shadowOf(int controller)
+{
+    static std::array<shadow_t, bcm_maxPwmControllers> shadows;
+
+    auto& shadow = shadows[controller];
+    std::call_once(shadow.loaded, [&shadow, controller]
+    {
+        auto ptr = bcm_pwmPerip(controller);
+        /* CLRF1 is a single shot, never kept */
+        shadow.ctl = ptr->CTL & ~PWM_CTL_CLRF1;
+        for (int ch = 0; ch < 2; ++ch)
+        {
+            shadow.rng[ch] = ptr->CHANNEL[ch].RNG;
+            shadow.dat[ch] = ptr->CHANNEL[ch].DAT;
+        }
+    });
+    return shadow;
+}
+
+/* Called after writing a shadowed value to its register. A writer overtaken by another between
+ * updating the shadow and writing the register finds the shadow moved on and writes again, so
+ * the register always ends up with the last value stored to the shadow */
+static void settle(std::atomic<uint32_t>& shadow, volatile uint32_t& reg, uint32_t written)
+{
+    for (auto latest = shadow.load(); latest != written; latest = shadow.load())
+    {
+        written = latest;
+        reg = written;
+    }
+}
+
+/* Skips the register write when the shadow holds the value already */
+static void publish(std::atomic<uint32_t>& shadow, volatile uint32_t& reg, uint32_t value)
+{
+    if (shadow.exchange(value) != value)
+    {
+        reg = value;
+        settle(shadow, reg, value);
+    }
+}
+
+/* Read-modify-write of CTL on the shadow, so channels changing it from different threads never
+ * lose each other's bits. once is written along but not kept */
+static void updateCtl(int controller, uint32_t clear, uint32_t set, uint32_t once = 0)
+{
+    auto& ctl = shadowOf(controller).ctl;
+    auto value = ctl.load();
+    uint32_t next;
+    do
+    {
+        next = (value & ~clear) | set;
+    }
+    while (!ctl.compare_exchange_weak(value, next));
+
+    if (next != value || once)
+    {
+        auto ptr = bcm_pwmPerip(controller);
+        ptr->CTL = next | once;
+        settle(ctl, ptr->CTL, next);
+    }
+}
+
 ControllerProviderList DMAPwmProvider::getControllers() const
+{
+    return getControllers(nullptr);
+}
+
+ControllerProviderList DMAPwmProvider::getControllers(const char* name) const
 {
     ControllerProviderList list;
-    for (std::size_t i = 0; i < bcm_numPwmControllers; ++i)
+    for (std::size_t i = 0; i < bcm_numPwmControllers(); ++i)
     {
         try
         {
             bcm_pwmPerip(i);
-            list.emplace_back(new DMAPwmControllerProvider(i));
+            auto controller = std::make_unique<DMAPwmControllerProvider>(i);
+            if (!name || !*name || std::strcmp(name, controller->name()) == 0)
+            {
+                list.push_back(std::move(controller));
+            }
         }
         catch (std::bad_alloc const&)
         {
@@ -33,11 +122,6 @@ ControllerProviderList DMAPwmProvider::getControllers() const
     return list;
 }
 
-ControllerProviderList DMAPwmProvider::getControllers(const char *) const
-{
-    return getControllers();
-}
-
 /* static */ DMAPwmProvider * DMAPwmProvider::getInstance() noexcept
 {
     static DMAPwmProvider provider;
@@ -56,7 +140,8 @@ IPwmChannelProvider* DMAPwmControllerProvider::open(int channel)
 
 const char* DMAPwmControllerProvider::name() const noexcept
 {
-    return "DMA PWM Controller";
+    static constexpr const char* names[bcm_maxPwmControllers] = {"PWM0", "PWM1"};
+    return names[id];
 }
 
 int DMAPwmControllerProvider::count() const noexcept
@@ -64,49 +149,140 @@ int DMAPwmControllerProvider::count() const noexcept
     return 2;
 }
 
+bool DMAPwmControllerProvider::commit(PwmChannelUpdate const* updates, std::size_t count) noexcept
+{
+    /* The hardware picks up RNG and DAT at the end of the running period, the writes follow
+     * each other closely enough to land in the same one */
+    auto& shadow = shadowOf(id);
+    auto ptr = bcm_pwmPerip(id);
+    uint32_t clear = 0;
+    uint32_t set = 0;
+    for (std::size_t ch = 0; ch < count && ch < 2; ++ch)
+    {
+        auto const& update = updates[ch];
+        if (update.range)
+        {
+            publish(shadow.rng[ch], ptr->CHANNEL[ch].RNG, *update.range);
+        }
+        if (update.data)
+        {
+            publish(shadow.dat[ch], ptr->CHANNEL[ch].DAT, *update.data);
+        }
+        if (update.polarity)
+        {
+            clear |= PWM_CTL_POLA1 << (8 * ch);
+            set |= *update.polarity == Polarity::ActiveLow ? PWM_CTL_POLA1 << (8 * ch) : 0;
+        }
+        if (update.enable)
+        {
+            clear |= (PWM_CTL_PWEN1 | PWM_CTL_MSEN1) << (8 * ch);
+            set |= *update.enable ? (PWM_CTL_PWEN1 | PWM_CTL_MSEN1) << (8 * ch) : 0;
+        }
+    }
+
+    if (clear)
+    {
+        updateCtl(id, clear, set);
+    }
+    return true;
+}
+
+/* static */ void DMAPwmControllerProvider::rewriteCtl(int controller) noexcept
+{
+    auto& ctl = shadowOf(controller).ctl;
+    const auto value = ctl.load();
+    auto ptr = bcm_pwmPerip(controller);
+    ptr->CTL = value;
+    settle(ctl, ptr->CTL, value);
+}
+
 void DMAPwmChannelProvider::setRange(uint32_t range) noexcept
 {
-    bcm_pwmPerip(controllerID)->CHANNEL[channel()].RNG = range;
+    publish(shadowOf(controllerID).rng[channel()], bcm_pwmPerip(controllerID)->CHANNEL[channel()].RNG, range);
 }
 uint32_t DMAPwmChannelProvider::getRange() const noexcept
 {
-    return bcm_pwmPerip(controllerID)->CHANNEL[channel()].RNG;
+    return shadowOf(controllerID).rng[channel()].load(std::memory_order_relaxed);
 }
 
 void DMAPwmChannelProvider::setData(uint32_t data) noexcept
 {
-    bcm_pwmPerip(controllerID)->CHANNEL[channel()].DAT = data;
+    publish(shadowOf(controllerID).dat[channel()], bcm_pwmPerip(controllerID)->CHANNEL[channel()].DAT, data);
 }
 uint32_t DMAPwmChannelProvider::getData() const noexcept
 {
-    return bcm_pwmPerip(controllerID)->CHANNEL[channel()].DAT;
+    return shadowOf(controllerID).dat[channel()].load(std::memory_order_relaxed);
 }
 
 void DMAPwmChannelProvider::setPolarity(Polarity polarity) noexcept
 {
-    auto ptr = bcm_pwmPerip(controllerID);
-    ptr->CTL = (ptr->CTL & ~(1 << (4 + 8*channel()))) |
-            ((static_cast<int>(polarity) & 0x01) << (4 + 8*channel()));
+    const uint32_t bit = PWM_CTL_POLA1 << (8 * channel());
+    updateCtl(controllerID, bit, polarity == Polarity::ActiveLow ? bit : 0);
 }
 Polarity DMAPwmChannelProvider::getPolarity() const noexcept
 {
-    auto pol = bcm_pwmPerip(controllerID)->CTL & (1 << (4 + 8 * channel()));
-    return static_cast<Polarity>(pol);
+    auto ctl = shadowOf(controllerID).ctl.load(std::memory_order_relaxed);
+    return (ctl & (PWM_CTL_POLA1 << (8 * channel()))) ? Polarity::ActiveLow : Polarity::ActiveHigh;
 }
 
 void DMAPwmChannelProvider::enable(bool en) noexcept
+{
+    const uint32_t bits = (PWM_CTL_PWEN1 | PWM_CTL_MSEN1) << (8 * channel());
+    updateCtl(controllerID, bits, en ? bits : 0);
+}
+[[nodiscard]] bool DMAPwmChannelProvider::isRunning() const noexcept
+{
+    return (bcm_pwmPerip(controllerID)->STA & (0x200 << channel())) != 0;
+}
+bool DMAPwmChannelProvider::enableFifo(bool en) noexcept
+{
+    /* Start from an empty FIFO, CLRF1 is a single shot */
+    const uint32_t bit = PWM_CTL_USEF1 << (8 * channel());
+    updateCtl(controllerID, bit, en ? bit : 0, en ? PWM_CTL_CLRF1 : 0);
+    return true;
+}
+
+std::size_t DMAPwmChannelProvider::writeFifo(uint32_t const* samples, std::size_t count) noexcept
 {
     auto ptr = bcm_pwmPerip(controllerID);
-    if (en)
+    std::size_t n = 0;
+    for (; n < count && !(ptr->STA & PWM_STA_FULL1); ++n)
     {
-        ptr->CTL |= (PWM_CTL_PWEN1 | PWM_CTL_MSEN1) << (8 * channel());
+        ptr->CHANNEL[0].FIF = samples[n];
     }
-    else
+    return n;
+}
+
+bool DMAPwmChannelProvider::fifoGap() noexcept
+{
+    /* GAPOn is write-1-to-clear */
+    auto ptr = bcm_pwmPerip(controllerID);
+    const uint32_t gap = PWM_STA_GAPO1 << channel();
+    if (ptr->STA & gap)
     {
-        ptr->CTL &= ~((PWM_CTL_PWEN1 | PWM_CTL_MSEN1) << (8 * channel()));
+        ptr->STA = gap;
+        return true;
     }
+    return false;
 }
-[[nodiscard]] bool DMAPwmChannelProvider::isRunning() const noexcept
+
+bool DMAPwmChannelProvider::enableDma(bool en, FifoDmaTarget* target) noexcept
 {
-    return (bcm_pwmPerip(controllerID)->STA & (0x200 << channel())) != 0;
-}
\ No newline at end of file
+    static constexpr int dreqs[bcm_maxPwmControllers] = {5, 1};
+
+    /* DREQ threshold 3, PANIC threshold 7 */
+    auto ptr = bcm_pwmPerip(controllerID);
+    ptr->DMAC = en ? PWM_DMAC_ENAB | PWM_DMAC_PANIC(7) | PWM_DMAC_DREQ(3) : 0;
+    if (en && target)
+    {
+        *target = {bcm_busAddress(&ptr->CHANNEL[0].FIF), dreqs[controllerID]};
+    }
+    return true;
+}
+
+bool DMAPwmChannelProvider::setSerializer(bool en) noexcept
+{
+    const uint32_t bit = PWM_CTL_MODE1 << (8 * channel());
+    updateCtl(controllerID, bit, en ? bit : 0);
+    return true;
+}
@@ -0,0 +1,90 @@
+#include "executor.hpp"
+#include "threadpolicy.hpp"
+
+using namespace Devices;
+
+/* Index of the pool worker running on this thread, if any */
+static thread_local WorkStealingExecutor* currentPool = nullptr;
+static thread_local std::size_t currentWorker = 0;
+
+WorkStealingExecutor::WorkStealingExecutor(std::size_t threads)
+{
+	threads = threads ? threads : 1;
+	for (std::size_t i = 0; i < threads; ++i)
+	{
+		_workers.emplace_back(new worker_t);
+	}
+	for (std::size_t i = 0; i < threads; ++i)
+	{
+		_workers[i]->thread = LibraryThreads::spawn(&WorkStealingExecutor::run, this, i);
+	}
+}
+
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+	{
+		std::lock_guard<std::mutex> guard(_sleepLock);
+		_running = false;
+	}
+	_wake.notify_all();
+
+	for (auto& worker : _workers)
+	{
+		worker->thread.join();
+	}
+}
+
+void WorkStealingExecutor::post(std::function<void()> task)
+{
+	auto index = currentPool == this ? currentWorker : _next++ % _workers.size();
+	{
+		std::lock_guard<std::mutex> guard(_workers[index]->lock);
+		_workers[index]->tasks.push_back(std::move(task));
+	}
+
+	if (_pending++ == 0)
+	{
+		/* Pairs with the check under the lock in run(), so the wakeup cannot be missed */
+		std::lock_guard<std::mutex> guard(_sleepLock);
+	}
+	_wake.notify_one();
+}
+
+bool WorkStealingExecutor::take(std::size_t index, std::function<void()>& task)
+{
+	/* Own queue first, then the others starting with the next worker */
+	for (std::size_t i = 0; i < _workers.size(); ++i)
+	{
+		auto& worker = *_workers[(index + i) % _workers.size()];
+
+		std::lock_guard<std::mutex> guard(worker.lock);
+		if (!worker.tasks.empty())
+		{
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			--_pending;
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkStealingExecutor::run(std::size_t index)
+{
+	currentPool = this;
+	currentWorker = index;
+
+	std::function<void()> task;
+	while (_running)
+	{
+		if (take(index, task))
+		{
+			task();
+			task = nullptr;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(_sleepLock);
+		_wake.wait(guard, [this]{ return _pending > 0 || !_running; });
+	}
+}
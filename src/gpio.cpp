@@ -2,12 +2,289 @@
 #include "ilowleveldevices.hpp"
 #include "exceptions.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 using namespace Devices;
 using namespace Devices::Gpio;
 using namespace Devices::Gpio::Provider;
 
+// ------------------------------------- Strand -----------------------------------------
+
+/**
+ *  Runs the callbacks of one pin on the callback executor, in order and one at a time
+ *
+ *  The interrupt engine queues the event and posts a drain task unless one is pending
+ *  already. The task keeps the strand alive until it is done.
+ */
+class Devices::Gpio::CallbackStrand : public std::enable_shared_from_this<CallbackStrand>
+{
+public:
+	static constexpr std::size_t capacity = 256;
+	static constexpr std::size_t batchSize = 16;
+
+	CallbackStrand(std::shared_ptr<IExecutor> executor, std::function<void(GpioEvent const&)> fn) :
+		_executor(std::move(executor)), _fn(std::move(fn)), _queue(capacity)
+	{
+	}
+
+	/* Interrupt engine thread only */
+	void push(GpioEvent const& event)
+	{
+		if (_closed)
+		{
+			return;
+		}
+
+		_queue.push(event);
+		if (!_scheduled.exchange(true))
+		{
+			_keepAlive = shared_from_this();
+			_executor->post([this]{ drain(); });
+		}
+	}
+
+	/* No callback runs after it returns, unless called from the callback itself */
+	void close()
+	{
+		_closed = true;
+
+		const auto self = std::this_thread::get_id();
+		for (auto drainer = _drainer.load(); drainer != std::thread::id{} && drainer != self; drainer = _drainer.load())
+		{
+			std::this_thread::yield();
+		}
+	}
+
+private:
+	void drain()
+	{
+		const auto self = std::move(_keepAlive);
+		GpioEvent batch[batchSize];
+
+		do
+		{
+			_drainer = std::this_thread::get_id();
+			while (!_closed)
+			{
+				const auto count = _queue.pop(batch, batchSize);
+				for (std::size_t i = 0; i < count; ++i)
+				{
+					_fn(batch[i]);
+				}
+				if (count < batchSize)
+				{
+					break;
+				}
+			}
+			_drainer = std::thread::id{};
+
+			/* An event queued before this store is either seen below or posts a new task */
+			_scheduled = false;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+		while (!_closed && _queue.size() && !_scheduled.exchange(true));
+	}
+
+	std::shared_ptr<IExecutor> _executor;
+	std::function<void(GpioEvent const&)> _fn;
+	GpioEventRing _queue;
+
+	std::atomic_bool _scheduled{false};
+	std::atomic_bool _closed{false};
+	std::atomic<std::thread::id> _drainer{};
+	std::shared_ptr<CallbackStrand> _keepAlive;
+};
+
+// ------------------------------------- Mailbox ----------------------------------------
+
+static PinEdge combine(PinEdge a, PinEdge b)
+{
+	if (a == PinEdge::None || a == b)
+	{
+		return b;
+	}
+	return b == PinEdge::None ? a : PinEdge::Both;
+}
+
+static bool matches(PinEdge wanted, PinEdge edge)
+{
+	return wanted == edge || wanted == PinEdge::Both;
+}
+
+/**
+ *  Threads blocked on the edges of one pin
+ *
+ *  A waiter lives on the stack of the waiting thread and is published in a free slot of the
+ *  mailbox of every pin it waits on. The first matching edge claims it and wakes it with a
+ *  futex, so the interrupt engine signals the waiting thread without any lock.
+ */
+class Devices::Gpio::EdgeMailbox
+{
+public:
+	static constexpr std::size_t slots = 8;
+
+	/* Interrupt engine thread only */
+	void post(GpioEvent const& event)
+	{
+		if (_count.load() == 0)
+		{
+			return;
+		}
+
+		++_notifying;
+		for (auto& slot : _waiters)
+		{
+			auto waiter = slot.load();
+			uint32_t waiting = Waiting;
+			if (waiter && matches(waiter->edge, event.edge) &&
+				waiter->state.compare_exchange_strong(waiting, Claimed))
+			{
+				waiter->event = event;
+				waiter->state.store(Ready);
+				futex(&waiter->state, FUTEX_WAKE_PRIVATE, 1, nullptr);
+			}
+		}
+		++_notifying;
+	}
+
+	static bool wait(EdgeMailbox* const* boxes, std::size_t count, PinEdge edge,
+					 std::chrono::nanoseconds timeout, GpioEvent* event)
+	{
+		waiter_t waiter{edge};
+
+		std::size_t added = 0;
+		for (; added < count && boxes[added]->add(&waiter); ++added);
+		if (added < count)
+		{
+			while (added)
+			{
+				boxes[--added]->remove(&waiter);
+			}
+			throw LLD::not_supported_exception{};
+		}
+
+		/* Absolute CLOCK_MONOTONIC deadline, so spurious wake ups do not extend the wait */
+		const bool forever = timeout > std::chrono::hours(24 * 365);
+		const auto deadline = std::chrono::steady_clock::now() + (forever ? std::chrono::nanoseconds{0} : timeout);
+		const auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+		const timespec until{static_cast<time_t>(since / 1000000000), static_cast<long>(since % 1000000000)};
+
+		for (auto state = waiter.state.load(); state != Ready; state = waiter.state.load())
+		{
+			if (state == Claimed)
+			{
+				std::this_thread::yield();
+			}
+			else if (!forever && std::chrono::steady_clock::now() >= deadline)
+			{
+				break;
+			}
+			else
+			{
+				futex(&waiter.state, FUTEX_WAIT_BITSET_PRIVATE, Waiting, forever ? nullptr : &until);
+			}
+		}
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			boxes[i]->remove(&waiter);
+		}
+
+		/* Claimed in the meantime, no engine touches the waiter any more */
+		if (waiter.state.load() != Ready)
+		{
+			return false;
+		}
+		if (event)
+		{
+			*event = waiter.event;
+		}
+		return true;
+	}
+
+private:
+	enum : uint32_t { Waiting, Claimed, Ready };
+
+	struct waiter_t
+	{
+		PinEdge edge;
+		std::atomic<uint32_t> state{Waiting};
+		GpioEvent event{};
+	};
+
+	static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, timespec const* timeout)
+	{
+		return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr,
+					   FUTEX_BITSET_MATCH_ANY);
+	}
+
+	bool add(waiter_t* waiter)
+	{
+		for (auto& slot : _waiters)
+		{
+			waiter_t* empty = nullptr;
+			if (slot.compare_exchange_strong(empty, waiter))
+			{
+				++_count;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void remove(waiter_t* waiter)
+	{
+		for (auto& slot : _waiters)
+		{
+			waiter_t* expected = waiter;
+			if (slot.compare_exchange_strong(expected, nullptr))
+			{
+				--_count;
+			}
+		}
+
+		/* The engine may still hold the waiter it loaded before */
+		if (auto round = _notifying.load(); round & 1)
+		{
+			while (_notifying.load() == round)
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	std::array<std::atomic<waiter_t*>, slots> _waiters{};
+	std::atomic<std::size_t> _count{0};
+	/* Odd while the engine walks the waiters */
+	std::atomic<uint64_t> _notifying{0};
+};
+
 // -------------------------------------- Pin -------------------------------------------
 
+GpioPin::GpioPin(IGpioPinProvider* impl) :
+	_provider(impl), _mailbox(std::make_shared<EdgeMailbox>())
+{
+}
+
+GpioPin::~GpioPin()
+{
+	/* Disarm first, so nothing is queued to the strand any more */
+	_provider.reset();
+	if (_strand)
+	{
+		_strand->close();
+	}
+	if (_ownEventFd >= 0)
+	{
+		close(_ownEventFd);
+	}
+}
+
 PinValue GpioPin::read() const
 {
 	return _provider->read();
@@ -28,9 +305,204 @@ void GpioPin::setDriveMode(PinDriveMode mode)
 
 void GpioPin::enableInterrupt(PinEdge edge, std::function<void(GpioPin*, PinEdge)> callback)
 {
-	_provider->enableInterrupt(edge, [this, callback](PinEdge edge) {
-		callback(this, edge);
-	});
+	if (_direct && edge != PinEdge::None)
+	{
+		throw LLD::not_supported_exception{};
+	}
+
+	std::lock_guard<std::mutex> lock(_armLock);
+	if (edge != PinEdge::None)
+	{
+		_edge = edge;
+	}
+	_callback = edge == PinEdge::None ? nullptr : std::move(callback);
+	rearm();
+}
+
+void GpioPin::setFilter(PinFilter const& filter)
+{
+	_provider->setFilter(filter);
+}
+
+uint64_t GpioPin::suppressedEdges() const noexcept
+{
+	return _provider->suppressedEdges();
+}
+
+void GpioPin::enableEvents(PinEdge edge, std::size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(_armLock);
+	if (edge != PinEdge::None)
+	{
+		_edge = edge;
+		if (!_events || _events->capacity() < capacity)
+		{
+			/* Events still queued in the previous ring are dropped */
+			_events = std::make_shared<GpioEventRing>(capacity);
+			_events->setNotifyFd(_direct ? -1 : _eventFd);
+		}
+	}
+	_queueing = edge != PinEdge::None;
+	rearm();
+}
+
+std::size_t GpioPin::readEvents(GpioEvent* events, std::size_t count)
+{
+	if (_direct)
+	{
+		return _provider->readEvents(events, count);
+	}
+	if (!_events)
+	{
+		return 0;
+	}
+
+	if (_eventFd >= 0 && _eventFd == _ownEventFd)
+	{
+		/* Reset before draining, the ring signals again for whatever it leaves behind */
+		uint64_t signalled;
+		[[maybe_unused]] auto rd = ::read(_eventFd, &signalled, sizeof signalled);
+	}
+	return _events->pop(events, count);
+}
+
+uint64_t GpioPin::lostEvents() const noexcept
+{
+	return _events ? _events->lost() : 0;
+}
+
+int GpioPin::eventFd()
+{
+	if (!_queueing)
+	{
+		throw LLD::not_supported_exception{};
+	}
+	if (_eventFd >= 0)
+	{
+		return _eventFd;
+	}
+
+	std::unique_lock<std::mutex> lock(_armLock);
+	if (!_callback && _waitEdge == PinEdge::None)
+	{
+		if (auto fd = _provider->enableEventFd(_edge); fd >= 0)
+		{
+			_direct = true;
+			_eventFd = fd;
+			return fd;
+		}
+	}
+
+	lock.unlock();
+
+	_ownEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (_ownEventFd < 0)
+	{
+		throw LLD::access_exception{};
+	}
+	setEventFd(_ownEventFd);
+	return _eventFd;
+}
+
+void GpioPin::setEventFd(int fd)
+{
+	if (_direct || !_queueing)
+	{
+		throw LLD::not_supported_exception{};
+	}
+
+	/* The own eventfd stays open until the pin is gone, the engine may be signalling it */
+	_eventFd = fd;
+	_events->setNotifyFd(fd);
+}
+
+bool GpioPin::waitForEdge(PinEdge edge, std::chrono::nanoseconds timeout, GpioEvent* event)
+{
+	auto box = prepareWait(edge);
+	return EdgeMailbox::wait(&box, 1, edge, timeout, event);
+}
+
+EdgeMailbox* GpioPin::prepareWait(PinEdge edge)
+{
+	if (edge == PinEdge::None)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::GpioPin::waitForEdge()",
+											  "Rising, Falling or Both", "None");
+	}
+
+	std::lock_guard<std::mutex> lock(_armLock);
+	if (_direct)
+	{
+		throw LLD::not_supported_exception{};
+	}
+	if (combine(_waitEdge, edge) != _waitEdge)
+	{
+		_waitEdge = combine(_waitEdge, edge);
+		rearm();
+	}
+	return _mailbox.get();
+}
+
+void GpioPin::rearm()
+{
+	if (_direct)
+	{
+		_provider->enableEventFd(_queueing ? _edge : PinEdge::None);
+		return;
+	}
+
+	auto events = _queueing ? _events : nullptr;
+	std::shared_ptr<CallbackStrand> strand;
+
+	/* Waiters and the other consumers may want different edges, each gets only its own */
+	const auto consumers = _callback || events;
+	const auto armed = combine(consumers ? _edge : PinEdge::None, _waitEdge);
+
+	if (armed == PinEdge::None)
+	{
+		_provider->enableInterrupt(PinEdge::None, nullptr);
+	}
+	else
+	{
+		std::function<void(GpioPin*, PinEdge)> callback;
+		if (auto executor = LowLevelDevicesController::getCallbackExecutor(); executor && _callback)
+		{
+			strand = std::make_shared<CallbackStrand>(std::move(executor), [this, callback = _callback](GpioEvent const& event) {
+				callback(this, event.edge);
+			});
+		}
+		else
+		{
+			callback = _callback;
+		}
+
+		_provider->enableInterrupt(armed, [this, edge = _edge, callback, events, strand, mailbox = _mailbox](GpioEvent const& event) {
+			mailbox->post(event);
+			if (!matches(edge, event.edge))
+			{
+				return;
+			}
+			if (events)
+			{
+				events->push(event);
+			}
+			if (strand)
+			{
+				strand->push(event);
+			}
+			else if (callback)
+			{
+				callback(this, event.edge);
+			}
+		});
+	}
+
+	/* Callbacks still queued to the replaced strand are dropped */
+	if (_strand)
+	{
+		_strand->close();
+	}
+	_strand = std::move(strand);
 }
 
 int GpioPin::pinNumber() const noexcept
@@ -38,9 +510,101 @@ int GpioPin::pinNumber() const noexcept
 	return _provider->pinNumber();
 }
 
+// -------------------------------------- Port ------------------------------------------
+
+GpioPort::GpioPort(IGpioPortProvider* impl, std::vector<int> pins, int base) :
+	_provider(impl), _pins(std::move(pins)), _shift(0), _consecutive(true)
+{
+	for (std::size_t i = 0; i < _pins.size(); ++i)
+	{
+		_offsets.push_back(_pins[i] - base);
+		_consecutive = _consecutive && _offsets[i] == _offsets[0] + static_cast<int>(i);
+	}
+	_shift = _offsets.empty() ? 0 : _offsets[0];
+
+	if (!_consecutive)
+	{
+		/* Controller bits of every value a byte of the port can take */
+		_lut.resize((_offsets.size() + 7) / 8);
+		for (std::size_t chunk = 0; chunk < _lut.size(); ++chunk)
+		{
+			for (std::size_t byte = 0; byte < 256; ++byte)
+			{
+				uint64_t bits = 0;
+				for (std::size_t bit = 0; bit < 8 && chunk * 8 + bit < _offsets.size(); ++bit)
+				{
+					if (byte & (1 << bit))
+					{
+						bits |= uint64_t{1} << _offsets[chunk * 8 + bit];
+					}
+				}
+				_lut[chunk][byte] = bits;
+			}
+		}
+	}
+}
+
+uint64_t GpioPort::spread(uint64_t value) const noexcept
+{
+	if (_consecutive)
+	{
+		const auto widthMask = _offsets.size() == 64 ? ~uint64_t{0} : ((uint64_t{1} << _offsets.size()) - 1);
+		return (value & widthMask) << _shift;
+	}
+
+	uint64_t bits = 0;
+	for (std::size_t chunk = 0; chunk < _lut.size(); ++chunk)
+	{
+		bits |= _lut[chunk][(value >> (8 * chunk)) & 0xff];
+	}
+	return bits;
+}
+
+uint64_t GpioPort::gather(uint64_t bits) const noexcept
+{
+	if (_consecutive)
+	{
+		return bits >> _shift;
+	}
+
+	uint64_t value = 0;
+	for (std::size_t i = 0; i < _offsets.size(); ++i)
+	{
+		value |= ((bits >> _offsets[i]) & 1) << i;
+	}
+	return value;
+}
+
+uint64_t GpioPort::read() const
+{
+	return gather(_provider->read());
+}
+void GpioPort::write(uint64_t mask, uint64_t value)
+{
+	_provider->write(spread(mask), spread(value));
+}
+void GpioPort::toggle(uint64_t mask)
+{
+	_provider->toggle(spread(mask));
+}
+
+void GpioPort::setDriveMode(PinDriveMode mode)
+{
+	_provider->setDriveMode(mode);
+}
+
+std::size_t GpioPort::width() const noexcept
+{
+	return _pins.size();
+}
+std::vector<int> GpioPort::pinNumbers() const
+{
+	return _pins;
+}
+
 // ----------------------------------- Controller ---------------------------------------
 
-/* static */ std::map<int, std::weak_ptr<GpioPin>> GpioController::access;
+/* static */ std::map<int, std::weak_ptr<void>> GpioController::access;
 
 GpioController::~GpioController()
 {
@@ -83,6 +647,55 @@ bool GpioController::tryOpen(int pin, std::shared_ptr<GpioPin>* out) noexcept
 	}
 }
 
+std::shared_ptr<GpioPort> GpioController::openPort(std::vector<int> const& pins)
+{
+	if (pins.empty() || pins.size() > 64)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::GpioController::openPort()",
+											  "0 < pins.size() <= 64",
+											  std::to_string(pins.size()));
+	}
+
+	/* Ports and single pins never share a line */
+	uint64_t mask = 0;
+	const int lines = std::min(_impl->count(), 64);
+	for (auto pin : pins)
+	{
+		if (pin < _impl->base() || pin - _impl->base() >= lines)
+		{
+			throw LLD::invalid_argument_exception("Devices::Gpio::GpioController::openPort()",
+												  "base() <= pin < base() + min(count(), 64)",
+												  std::to_string(pin));
+		}
+
+		auto it = access.find(pin);
+		if ((it != access.end() && !it->second.expired()) || (mask & (uint64_t{1} << (pin - _impl->base()))))
+		{
+			throw LLD::access_violation_exception{};
+		}
+		mask |= uint64_t{1} << (pin - _impl->base());
+	}
+
+	std::shared_ptr<GpioPort> tmp(new GpioPort(_impl->openPort(mask), pins, _impl->base()));
+	for (auto pin : pins)
+	{
+		access[pin] = tmp;
+	}
+	return tmp;
+}
+
+/* static */ bool GpioController::waitAny(std::vector<std::shared_ptr<GpioPin>> const& pins, PinEdge edge,
+										 std::chrono::nanoseconds timeout, GpioEvent* event)
+{
+	std::vector<EdgeMailbox*> boxes;
+	boxes.reserve(pins.size());
+	for (auto const& pin : pins)
+	{
+		boxes.push_back(pin->prepareWait(edge));
+	}
+	return EdgeMailbox::wait(boxes.data(), boxes.size(), edge, timeout, event);
+}
+
 int GpioController::count() const noexcept
 {
 	return _impl->count();
@@ -91,6 +704,10 @@ std::string GpioController::name() const
 {
 	return _impl->name();
 }
+bool GpioController::isMemoryMapped() const noexcept
+{
+	return _impl->isMemoryMapped();
+}
 
 /* static */ std::shared_ptr<GpioController> GpioController::getDefault()
 {
@@ -0,0 +1,144 @@
+#include "devices/ledstrip.hpp"
+#include "clock.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using namespace Devices;
+using namespace Devices::Pwm;
+
+/* Three serializer bits per 1.25us LED bit, WS2812 parts take +-150ns on the 417ns */
+static constexpr double bitClock = 2400000.0;
+static constexpr double clockTolerance = 0.05;
+
+/* Serializer pattern of every byte, 3 bits per bit, MSB first */
+static constexpr std::array<uint32_t, 256> patterns = []{
+	std::array<uint32_t, 256> table{};
+	for (uint32_t byte = 0; byte < 256; ++byte)
+	{
+		uint32_t pattern = 0;
+		for (int bit = 7; bit >= 0; --bit)
+		{
+			pattern = (pattern << 3) | ((byte >> bit) & 1 ? 0b110u : 0b100u);
+		}
+		table[byte] = pattern;
+	}
+	return table;
+}();
+
+LedStrip::LedStrip(std::shared_ptr<PwmChannel> channel, std::size_t leds, int dmaChannel) :
+	_channel(std::move(channel)), _leds(leds),
+	/* 72 bits per LED, in 32 bit words, padded with low time to whole DMA segments */
+	_frame(((leds * 72 + 31) / 32 + resetWords + PwmStream::segmentLength - 1) / PwmStream::segmentLength * PwmStream::segmentLength)
+{
+	if (!_channel || leds == 0)
+	{
+		throw LLD::invalid_argument_exception("Devices::Pwm::LedStrip::LedStrip()",
+											  "a channel and at least one LED",
+											  std::to_string(leds));
+	}
+
+	const auto clock = Clocks::ClockManager::GetPWMClockFrequency();
+	if (std::abs(clock - bitClock) > bitClock * clockTolerance)
+	{
+		throw LLD::invalid_argument_exception("Devices::Pwm::LedStrip::LedStrip()",
+											  "a 2.4MHz PWM clock, see LedStrip::takeClock()",
+											  std::to_string(clock));
+	}
+	_wordRate = clock / 32;
+
+	if (!_channel->_provider->setSerializer(true))
+	{
+		throw LLD::not_supported_exception{};
+	}
+	_channel->setRange(32);
+
+	/* Room for two frames, the one shifting out and the next */
+	_stream = std::make_unique<PwmStream>(_channel, _wordRate, 2 * _frame.size(), dmaChannel);
+	if (!_stream->dma())
+	{
+		_stream.reset();
+		_channel->_provider->setSerializer(false);
+		throw LLD::not_supported_exception{};
+	}
+}
+
+/* static */ double LedStrip::takeClock()
+{
+	/* The oscillator divides down to 2.4MHz closely on every SoC, MASH stays off */
+	const auto oscillator = Clocks::ClockManager::GetSourceFrequency(Clocks::ClockSource::Oscillator);
+	const auto divider = static_cast<int>(std::lround(oscillator / bitClock));
+	Clocks::ClockManager::SetPWMClock(Clocks::ClockSource::Oscillator, divider, 0);
+	return Clocks::ClockManager::GetPWMClockFrequency();
+}
+
+LedStrip::~LedStrip()
+{
+	_stream.reset();
+	_channel->_provider->setSerializer(false);
+}
+
+std::size_t LedStrip::encode(Rgb const* colors, std::size_t count)
+{
+	count = std::min(count, _leds);
+
+	/* Bytes go in as 24 bit patterns, out as 32 bit words */
+	uint64_t bits = 0;
+	unsigned pending = 0;
+	std::size_t words = 0;
+	auto put = [&](uint8_t byte) {
+		bits = (bits << 24) | patterns[byte];
+		pending += 24;
+		while (pending >= 32)
+		{
+			pending -= 32;
+			_frame[words++] = static_cast<uint32_t>(bits >> pending);
+		}
+	};
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		put(colors[i].g);
+		put(colors[i].r);
+		put(colors[i].b);
+	}
+	for (std::size_t i = count; i < _leds; ++i)
+	{
+		put(0);
+		put(0);
+		put(0);
+	}
+	if (pending)
+	{
+		_frame[words++] = static_cast<uint32_t>(bits << (32 - pending));
+	}
+
+	std::fill(_frame.begin() + words, _frame.end(), 0);
+	return _frame.size();
+}
+
+void LedStrip::show(Rgb const* colors, std::size_t count)
+{
+	const auto words = encode(colors, count);
+
+	for (std::size_t sent = 0; sent < words; )
+	{
+		sent += _stream->write(&_frame[sent], words - sent);
+		if (sent < words)
+		{
+			/* The previous frame is still shifting out, come back when part of it has */
+			std::this_thread::sleep_for(std::chrono::duration<double>((words - sent) / _wordRate / 2));
+		}
+	}
+}
+
+void LedStrip::flush()
+{
+	while (const auto queued = _stream->queued())
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(queued / _wordRate));
+	}
+}
@@ -0,0 +1,235 @@
+#include "devices/logiccapture.hpp"
+#include "devices/gpio.hpp"
+#include "bcm_host.hpp"
+#include "exceptions.hpp"
+#include "threadpolicy.hpp"
+
+using namespace Devices;
+using namespace Devices::Gpio;
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+/* Sleeping is only worth it this far ahead of the next sample, closer than that the thread spins */
+static constexpr std::chrono::microseconds sleepThreshold{200};
+
+/* Unsigned LEB128, returns the bytes read or 0 past the end */
+static std::size_t readVarint(uint8_t const* data, std::size_t size, uint64_t& value)
+{
+	value = 0;
+	for (std::size_t i = 0; i < size && i < 10; ++i)
+	{
+		value |= uint64_t{data[i] & 0x7fu} << (7 * i);
+		if (!(data[i] & 0x80))
+		{
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+LogicCapture::LogicCapture(uint64_t pins, std::chrono::nanoseconds interval, std::size_t bufferSize) :
+	_pins(pins), _interval(interval), _buffer(bufferSize)
+{
+	if (pins == 0 || (pins >> 54))
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::LogicCapture::LogicCapture()",
+											  "pins within 0-53",
+											  std::to_string(pins));
+	}
+	if (interval.count() <= 0)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::LogicCapture::LogicCapture()",
+											  "interval > 0",
+											  std::to_string(interval.count()));
+	}
+	if (!GpioController::getDefault()->isMemoryMapped())
+	{
+		throw LLD::not_supported_exception{};
+	}
+}
+
+LogicCapture::~LogicCapture()
+{
+	stop();
+}
+
+void LogicCapture::start()
+{
+	stop();
+
+	_overflowed = false;
+	_used = 0;
+	_samples = 0;
+	_missed = 0;
+
+	_running = true;
+	_thread = LibraryThreads::spawn(&LogicCapture::run, this);
+
+	/* Whatever the caller does next is captured */
+	while (_samples.load() == 0 && _running.load())
+	{
+		std::this_thread::yield();
+	}
+}
+
+void LogicCapture::stop()
+{
+	_running = false;
+	if (_thread.joinable())
+	{
+		_thread.join();
+	}
+}
+
+bool LogicCapture::append(uint64_t samples, uint64_t changes) noexcept
+{
+	auto used = _used.load(std::memory_order_relaxed);
+
+	/* Two varints take 20 bytes at most, checking once keeps the loop below branch free */
+	if (_buffer.size() - used < 20)
+	{
+		return false;
+	}
+
+	for (auto value : {samples, changes})
+	{
+		while (value >= 0x80)
+		{
+			_buffer[used++] = static_cast<uint8_t>(value | 0x80);
+			value >>= 7;
+		}
+		_buffer[used++] = static_cast<uint8_t>(value);
+	}
+
+	_used.store(used, std::memory_order_release);
+	return true;
+}
+
+void LogicCapture::run()
+{
+	using clock = std::chrono::steady_clock;
+
+	const auto regs = bcm_gpioPerip();
+	const bool high = _pins >> 32;
+	auto sample = [regs, high, pins = _pins] {
+		uint64_t levels = regs->GPLEV[0];
+		if (high)
+		{
+			levels |= uint64_t{regs->GPLEV[1]} << 32;
+		}
+		return levels & pins;
+	};
+
+	const auto start = clock::now();
+	auto last = sample();
+	uint64_t index = 0, recorded = 0, missed = 0;
+
+	/* The first record holds the levels themselves */
+	if (!append(0, last))
+	{
+		_overflowed = true;
+		_running = false;
+		return;
+	}
+	_samples.store(1, std::memory_order_relaxed);
+
+	while (_running.load(std::memory_order_relaxed))
+	{
+		const auto next = start + (index + 1) * _interval;
+		auto now = clock::now();
+		if (next - now > sleepThreshold)
+		{
+			std::this_thread::sleep_until(next - sleepThreshold / 2);
+			now = clock::now();
+		}
+		while (now < next)
+		{
+			cpuRelax();
+			now = clock::now();
+		}
+
+		const auto levels = sample();
+		const uint64_t slot = (now - start) / _interval;
+		missed += slot - index - 1;
+		index = slot;
+
+		if (levels != last)
+		{
+			if (!append(index - recorded, levels ^ last))
+			{
+				_overflowed.store(true, std::memory_order_relaxed);
+				_running.store(false, std::memory_order_relaxed);
+				break;
+			}
+			recorded = index;
+			last = levels;
+		}
+
+		_samples.store(index + 1, std::memory_order_relaxed);
+		_missed.store(missed, std::memory_order_relaxed);
+	}
+}
+
+void LogicCapture::forEach(std::function<void(std::chrono::nanoseconds, uint64_t)> const& fn) const
+{
+	const auto used = _used.load(std::memory_order_acquire);
+
+	uint64_t index = 0, levels = 0;
+	for (std::size_t at = 0; at < used;)
+	{
+		uint64_t samples, changes;
+		at += readVarint(&_buffer[at], used - at, samples);
+		at += readVarint(&_buffer[at], used - at, changes);
+
+		index += samples;
+		levels ^= changes;
+		fn(_interval * index, levels);
+	}
+}
+
+void LogicCapture::writeVcd(std::ostream& out) const
+{
+	/* Identifiers are single printable characters, '!' onwards */
+	auto id = [](int pin) { return static_cast<char>('!' + pin); };
+
+	out << "$timescale 1ns $end\n"
+		<< "$scope module gpio $end\n";
+	for (auto pins = _pins; pins; pins &= pins - 1)
+	{
+		const int pin = __builtin_ctzll(pins);
+		out << "$var wire 1 " << id(pin) << " gpio" << pin << " $end\n";
+	}
+	out << "$upscope $end\n"
+		<< "$enddefinitions $end\n";
+
+	bool first = true;
+	uint64_t previous = 0;
+	forEach([&](std::chrono::nanoseconds time, uint64_t levels) {
+		out << '#' << time.count() << '\n';
+		if (first)
+		{
+			out << "$dumpvars\n";
+		}
+		for (auto pins = first ? _pins : levels ^ previous; pins; pins &= pins - 1)
+		{
+			const int pin = __builtin_ctzll(pins);
+			out << ((levels >> pin) & 1 ? '1' : '0') << id(pin) << '\n';
+		}
+		if (first)
+		{
+			out << "$end\n";
+		}
+		first = false;
+		previous = levels;
+	});
+
+	/* Marks how long the capture ran, the levels held until then */
+	out << '#' << (_interval * samples()).count() << '\n';
+}
@@ -19,6 +19,28 @@ using namespace Devices;
         }
     }();
 
+static std::shared_ptr<IExecutor> callbackExecutor;
+
+/* static */ void LowLevelDevicesController::setCallbackExecutor(std::shared_ptr<IExecutor> executor)
+{
+    std::atomic_store(&callbackExecutor, std::move(executor));
+}
+
+/* static */ std::shared_ptr<IExecutor> LowLevelDevicesController::getCallbackExecutor()
+{
+    return std::atomic_load(&callbackExecutor);
+}
+
+/* static */ void LowLevelDevicesController::setThreadPolicy(ThreadPolicy const& policy)
+{
+    LibraryThreads::setPolicy(policy);
+}
+
+/* static */ ThreadPolicy LowLevelDevicesController::getThreadPolicy()
+{
+    return LibraryThreads::getPolicy();
+}
+
 // ----------------------------------------------------------------------------
 
 std::unique_ptr<Devices::Gpio::Provider::IGpioControllerProvider> DefaultAggregateProvider::GetGpioController() const 
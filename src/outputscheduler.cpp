@@ -0,0 +1,176 @@
+#include "devices/outputscheduler.hpp"
+#include "exceptions.hpp"
+#include "threadpolicy.hpp"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace Devices;
+using namespace Devices::Gpio;
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+/* Sleeping is only worth it this far ahead of the next command, closer than that the thread spins */
+static constexpr uint64_t sleepThreshold = 200000;
+
+static uint64_t nanoseconds(std::chrono::steady_clock::time_point when)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+}
+
+static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, timespec const* timeout)
+{
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr,
+				   FUTEX_BITSET_MATCH_ANY);
+}
+
+OutputScheduler::OutputScheduler(std::shared_ptr<GpioPort> port, std::size_t capacity) :
+	_port(std::move(port)), _commands(capacity), _results(capacity)
+{
+	if (!_port || _port->width() == 0)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::OutputScheduler::OutputScheduler()",
+											  "a port of at least one pin",
+											  "none");
+	}
+
+	/* Room for every command the queue can hold, so the thread never allocates */
+	_pending.reserve(_commands.capacity());
+	_port->setDriveMode(PinDriveMode::Output);
+
+	_thread = LibraryThreads::spawn(&OutputScheduler::run, this);
+}
+
+OutputScheduler::~OutputScheduler()
+{
+	_running = false;
+	_posted.fetch_add(1);
+	futex(&_posted, FUTEX_WAKE_PRIVATE, 1, nullptr);
+	_thread.join();
+}
+
+uint64_t OutputScheduler::schedule(clock::time_point when, uint64_t set, uint64_t clear)
+{
+	const auto id = _nextId.fetch_add(1, std::memory_order_relaxed);
+	if (!_commands.push(command_t{id, nanoseconds(when), set, clear}))
+	{
+		return 0;
+	}
+
+	/* Sequentially consistent with the thread going to sleep, see wait() */
+	_posted.fetch_add(1);
+	if (_sleeping.load())
+	{
+		futex(&_posted, FUTEX_WAKE_PRIVATE, 1, nullptr);
+	}
+	return id;
+}
+
+std::size_t OutputScheduler::readResults(OutputResult* results, std::size_t count)
+{
+	std::size_t n = 0;
+	while (n < count && _results.pop(results[n]))
+	{
+		++n;
+	}
+	return n;
+}
+
+bool OutputScheduler::drain()
+{
+	/* Returns whether a command went to the front */
+	bool earlier = false;
+	command_t command;
+	while (_pending.size() < _pending.capacity() && _commands.pop(command))
+	{
+		auto at = _pending.end();
+		while (at != _pending.begin() && std::prev(at)->when > command.when)
+		{
+			--at;
+		}
+		earlier = earlier || at == _pending.begin();
+		_pending.insert(at, command);
+	}
+	return earlier;
+}
+
+void OutputScheduler::wait(uint32_t posted, uint64_t until)
+{
+	/* A command posted after the snapshot either sees _sleeping or changes the futex word */
+	_sleeping.store(true);
+	if (until)
+	{
+		const timespec deadline{static_cast<time_t>(until / 1000000000), static_cast<long>(until % 1000000000)};
+		futex(&_posted, FUTEX_WAIT_BITSET_PRIVATE, posted, &deadline);
+	}
+	else
+	{
+		futex(&_posted, FUTEX_WAIT_BITSET_PRIVATE, posted, nullptr);
+	}
+	_sleeping.store(false);
+}
+
+void OutputScheduler::run()
+{
+	uint64_t value = 0;
+	while (_running.load(std::memory_order_relaxed))
+	{
+		const auto posted = _posted.load();
+		drain();
+
+		if (_pending.empty())
+		{
+			wait(posted, 0);
+			continue;
+		}
+
+		const auto due = _pending.front().when;
+		if (auto now = nanoseconds(clock::now()); due > now + sleepThreshold)
+		{
+			wait(posted, due - sleepThreshold / 2);
+			continue;
+		}
+
+		/* Close enough to spin, still taking any command that might come first */
+		uint64_t now;
+		bool earlier = false;
+		while ((now = nanoseconds(clock::now())) < due && !(earlier = drain()))
+		{
+			cpuRelax();
+		}
+		if (earlier)
+		{
+			continue;
+		}
+
+		std::size_t taken = 0;
+		uint64_t mask = 0;
+		for (; taken < _pending.size() && _pending[taken].when <= now; ++taken)
+		{
+			auto const& command = _pending[taken];
+			mask |= command.set | command.clear;
+			value = (value & ~command.clear) | command.set;
+		}
+
+		_port->write(mask, value);
+		const auto actual = clock::now();
+
+		for (std::size_t i = 0; i < taken; ++i)
+		{
+			const auto requested = clock::time_point{std::chrono::nanoseconds{_pending[i].when}};
+			if (!_results.push(OutputResult{_pending[i].id, requested, actual}))
+			{
+				_droppedResults.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		_pending.erase(_pending.begin(), _pending.begin() + taken);
+	}
+}
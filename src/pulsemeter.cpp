@@ -0,0 +1,212 @@
+#include "devices/pulsemeter.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace Devices;
+using namespace Devices::Gpio;
+
+/* Indices into _published */
+enum : std::size_t { PeriodMin, PeriodMax, PeriodSum, HighMin, HighMax, HighSum, Samples, LastEdge };
+
+/**
+ *  Extreme of the last samples of a sliding window, O(1) amortized per sample
+ *
+ *  Holds the samples that may still become the extreme, in window order, so the front is it.
+ */
+template<typename Better>
+class Wedge
+{
+public:
+	explicit Wedge(std::size_t capacity) : _slots(capacity) {}
+
+	void push(uint64_t index, uint64_t value, std::size_t window)
+	{
+		while (_size && !Better{}(_slots[(_head + _size - 1) % _slots.size()].second, value))
+		{
+			--_size;
+		}
+		if (_size && _slots[_head].first + window <= index)
+		{
+			_head = (_head + 1) % _slots.size();
+			--_size;
+		}
+		_slots[(_head + _size) % _slots.size()] = {index, value};
+		++_size;
+	}
+
+	[[nodiscard]] uint64_t front() const { return _slots[_head].second; }
+
+private:
+	std::vector<std::pair<uint64_t, uint64_t>> _slots;
+	std::size_t _head{0};
+	std::size_t _size{0};
+};
+
+struct PulseMeter::Window
+{
+	explicit Window(std::size_t size) :
+		size(size), periods(size), highs(size),
+		periodMin(size), periodMax(size), highMin(size), highMax(size)
+	{
+	}
+
+	const std::size_t size;
+	std::vector<uint64_t> periods;
+	std::vector<uint64_t> highs;
+	uint64_t periodSum{0};
+	uint64_t highSum{0};
+	uint64_t count{0};
+
+	Wedge<std::less<uint64_t>> periodMin;
+	Wedge<std::greater<uint64_t>> periodMax;
+	Wedge<std::less<uint64_t>> highMin;
+	Wedge<std::greater<uint64_t>> highMax;
+
+	/* Edge tracking, a pulse is a rise, a fall and the next rise */
+	uint64_t rise{0};
+	uint64_t fall{0};
+	bool rose{false};
+	bool fell{false};
+	uint64_t last{0};
+
+	void add(uint64_t period, uint64_t high)
+	{
+		const auto slot = count % size;
+		if (count >= size)
+		{
+			periodSum -= periods[slot];
+			highSum -= highs[slot];
+		}
+		periods[slot] = period;
+		highs[slot] = high;
+		periodSum += period;
+		highSum += high;
+
+		periodMin.push(count, period, size);
+		periodMax.push(count, period, size);
+		highMin.push(count, high, size);
+		highMax.push(count, high, size);
+		++count;
+	}
+};
+
+PulseMeter::PulseMeter(std::shared_ptr<GpioPin> pin, std::size_t window) :
+	_pin(std::move(pin))
+{
+	if (!_pin || window == 0)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::PulseMeter::PulseMeter()",
+											  "a pin and a window of at least one pulse",
+											  _pin ? "window 0" : "no pin");
+	}
+	if (_pin->_direct)
+	{
+		/* The line is read by the caller's event loop, it cannot be shared */
+		throw LLD::not_supported_exception{};
+	}
+
+	_window = std::make_unique<Window>(window);
+	_pin->_provider->enableInterrupt(PinEdge::Both, [this](GpioEvent const& event) { edge(event); });
+}
+
+PulseMeter::~PulseMeter()
+{
+	/* Hand the pin back to its own consumers, if any */
+	_pin->rearm();
+}
+
+PulseStats PulseMeter::stats() const noexcept
+{
+	std::array<uint64_t, 8> values;
+	for (;;)
+	{
+		const auto before = _sequence.load(std::memory_order_acquire);
+		if (before & 1)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		for (std::size_t i = 0; i < values.size(); ++i)
+		{
+			values[i] = _published[i].load(std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (_sequence.load(std::memory_order_relaxed) == before)
+		{
+			break;
+		}
+	}
+
+	using std::chrono::nanoseconds;
+	const auto samples = values[Samples];
+	return PulseStats{
+		nanoseconds(values[PeriodMin]), nanoseconds(values[PeriodMax]),
+		nanoseconds(samples ? values[PeriodSum] / samples : 0),
+		nanoseconds(values[HighMin]), nanoseconds(values[HighMax]),
+		nanoseconds(samples ? values[HighSum] / samples : 0),
+		static_cast<std::size_t>(samples), nanoseconds(values[LastEdge])
+	};
+}
+
+void PulseMeter::edge(GpioEvent const& event)
+{
+	auto& w = *_window;
+	w.last = event.timestamp;
+
+	if (event.edge == PinEdge::Falling)
+	{
+		/* Two falls in a row, the rise in between was lost */
+		if (w.fell)
+		{
+			w.rose = false;
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		w.fell = true;
+		w.fall = event.timestamp;
+	}
+	else
+	{
+		if (w.rose && w.fell)
+		{
+			w.add(event.timestamp - w.rise, w.fall - w.rise);
+		}
+		else if (w.rose)
+		{
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		w.rose = true;
+		w.fell = false;
+		w.rise = event.timestamp;
+	}
+
+	publish();
+}
+
+void PulseMeter::publish()
+{
+	auto& w = *_window;
+	const auto sequence = _sequence.load(std::memory_order_relaxed);
+
+	_sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (w.count)
+	{
+		_published[PeriodMin].store(w.periodMin.front(), std::memory_order_relaxed);
+		_published[PeriodMax].store(w.periodMax.front(), std::memory_order_relaxed);
+		_published[PeriodSum].store(w.periodSum, std::memory_order_relaxed);
+		_published[HighMin].store(w.highMin.front(), std::memory_order_relaxed);
+		_published[HighMax].store(w.highMax.front(), std::memory_order_relaxed);
+		_published[HighSum].store(w.highSum, std::memory_order_relaxed);
+		_published[Samples].store(std::min<uint64_t>(w.count, w.size), std::memory_order_relaxed);
+	}
+	_published[LastEdge].store(w.last, std::memory_order_relaxed);
+
+	_sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -1,6 +1,12 @@
 #include <exceptions.hpp>
 #include "devices/pwm.hpp"
 #include "ilowleveldevices.hpp"
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
 
 using namespace Devices;
 using namespace Devices::Pwm;
@@ -47,18 +53,122 @@ int PwmChannel::channel() const NOEXCEPT
     return _provider->channel();
 }
 
+double PwmChannel::setFrequency(double hz)
+{
+	const auto clock = Clocks::ClockManager::GetPWMClockFrequency();
+	if (clock == 0.0)
+	{
+		/* Every frequency would look out of reach, name the actual cause */
+		throw LLD::invalid_argument_exception("Devices::Pwm::PwmChannel::setFrequency()",
+											  "a running PWM clock, see Clocks::ClockManager::SetPWMClock()",
+											  "a stopped PWM clock");
+	}
+	/* Range 2 still gives a 0, 50 and 100% duty cycle */
+	const auto range = std::round(clock / hz);
+	if (!(hz > 0.0) || range < 2.0 || range > std::numeric_limits<uint32_t>::max())
+	{
+		throw LLD::invalid_argument_exception("Devices::Pwm::PwmChannel::setFrequency()",
+											  "PWM clock / 2^32 < hz <= PWM clock / 2",
+											  std::to_string(hz));
+	}
+
+	const auto duty = dutyCycle();
+	const auto next = static_cast<uint32_t>(range);
+	/* Shrinking, data first so it never exceeds the range */
+	if (next < _provider->getRange())
+	{
+		_provider->setData(static_cast<uint32_t>(std::llround(duty * next)));
+		_provider->setRange(next);
+	}
+	else
+	{
+		_provider->setRange(next);
+		_provider->setData(static_cast<uint32_t>(std::llround(duty * next)));
+	}
+	return clock / next;
+}
+
+double PwmChannel::frequency() const NOEXCEPT
+{
+	const auto range = _provider->getRange();
+	return range ? Clocks::ClockManager::GetPWMClockFrequency() / range : 0.0;
+}
+
+void PwmChannel::setDutyCycle(double fraction) NOEXCEPT
+{
+	fraction = std::clamp(fraction, 0.0, 1.0);
+	_provider->setData(static_cast<uint32_t>(std::llround(fraction * _provider->getRange())));
+}
+
+double PwmChannel::dutyCycle() const NOEXCEPT
+{
+	const auto range = _provider->getRange();
+	return range ? std::min(1.0, static_cast<double>(_provider->getData()) / range) : 0.0;
+}
+
+double PwmChannel::resolution() const NOEXCEPT
+{
+	const auto range = _provider->getRange();
+	return range ? 1.0 / range : 0.0;
+}
+
 // --------------------------------------------------------------------------------------
-/* static */ std::map<int, std::weak_ptr<PwmChannel>> PwmController::access{};
+Provider::PwmChannelUpdate& PwmTransaction::staged(int channel, const char* fn)
+{
+	if (channel < 0 || channel >= std::min(maxChannels, _controller->count()))
+	{
+		throw LLD::invalid_argument_exception(fn, "0 <= channel < count()", std::to_string(channel));
+	}
+	return _updates[channel];
+}
+
+PwmTransaction& PwmTransaction::setRange(int channel, uint32_t range)
+{
+	staged(channel, "Devices::Pwm::PwmTransaction::setRange()").range = range;
+	return *this;
+}
+
+PwmTransaction& PwmTransaction::setData(int channel, uint32_t data)
+{
+	staged(channel, "Devices::Pwm::PwmTransaction::setData()").data = data;
+	return *this;
+}
+
+PwmTransaction& PwmTransaction::setPolarity(int channel, Polarity polarity)
+{
+	staged(channel, "Devices::Pwm::PwmTransaction::setPolarity()").polarity = polarity;
+	return *this;
+}
+
+PwmTransaction& PwmTransaction::enable(int channel, bool en)
+{
+	staged(channel, "Devices::Pwm::PwmTransaction::enable()").enable = en;
+	return *this;
+}
+
+void PwmTransaction::commit()
+{
+	const bool done = _controller->commit(_updates.data(), _updates.size());
+	_updates = {};
+	if (!done)
+	{
+		throw LLD::not_supported_exception{};
+	}
+}
+
+// --------------------------------------------------------------------------------------
+/* static */ std::map<std::pair<std::string, int>, std::weak_ptr<PwmChannel>> PwmController::access{};
 std::shared_ptr<PwmChannel> PwmController::open(int channel)
 {
-    auto it = access.find(channel);
+    const auto key = std::make_pair(name(), channel);
+    auto it = access.find(key);
     if (it != access.end() && !it->second.expired())
     {
         throw LLD::access_violation_exception{};
     }
 
     std::shared_ptr<PwmChannel> tmp(new PwmChannel(_provider->open(channel)));
-    access[channel] = tmp;
+    access[key] = tmp;
 	return tmp;
 }
 
@@ -85,6 +195,11 @@ int PwmController::count() const noexcept
 	return _provider->count();
 }
 
+PwmTransaction PwmController::transaction() noexcept
+{
+	return PwmTransaction(_provider.get());
+}
+
 /* static */ std::shared_ptr<PwmController> PwmController::getDefault()
 {
     auto ctrl = LowLevelDevicesController::defaultProvider->GetPwmController();
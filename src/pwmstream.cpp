@@ -0,0 +1,325 @@
+#include "devices/pwmstream.hpp"
+#include "exceptions.hpp"
+#include "threadpolicy.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace Devices;
+using namespace Devices::Pwm;
+
+static std::size_t roundUp(std::size_t n) noexcept
+{
+	std::size_t size = 1;
+	while (size < n)
+	{
+		size <<= 1;
+	}
+	return size;
+}
+
+/* Channel priorities as high as they go, the FIFO drains at a fixed rate */
+static constexpr uint32_t csFlags = DMA_CS_WAIT_WRITES | DMA_CS_PANIC_PRIORITY(15) | DMA_CS_PRIORITY(15);
+
+PwmStream::PwmStream(std::shared_ptr<PwmChannel> channel, double sampleRate, std::size_t capacity, int dmaChannel) :
+	_channel(std::move(channel)), _sampleRate(sampleRate),
+	_capacity(roundUp(std::max(capacity, 2 * segmentLength))), _mask(_capacity - 1), _scratch(_capacity / 2)
+{
+	if (!_channel || !(sampleRate > 0.0))
+	{
+		throw LLD::invalid_argument_exception("Devices::Pwm::PwmStream::PwmStream()",
+											  "a channel and a sample rate > 0",
+											  std::to_string(sampleRate));
+	}
+	if (!_channel->_provider->enableFifo(true))
+	{
+		throw LLD::not_supported_exception{};
+	}
+
+	if (dmaChannel < 0 || !startDma(dmaChannel))
+	{
+		_ring.resize(_capacity);
+		_samples = _ring.data();
+	}
+	_channel->enable(true);
+
+	if (!_dmaRegs)
+	{
+		_thread = LibraryThreads::spawn(&PwmStream::run, this);
+	}
+}
+
+PwmStream::~PwmStream()
+{
+	_running = false;
+	if (_thread.joinable())
+	{
+		_thread.join();
+	}
+	if (_dmaRegs)
+	{
+		stopDma();
+	}
+	_channel->_provider->enableFifo(false);
+}
+
+bool PwmStream::startDma(int channel)
+{
+	volatile dma_channel_t* regs;
+	try
+	{
+		bcm_dmaPerip();
+		regs = bcm_dmaChannel(channel);
+	}
+	catch (LLD::lowleveldevices_exception const&)
+	{
+		return false;
+	}
+
+	_segments = _capacity / segmentLength;
+	if (!bcm_dmaAlloc(_segments * sizeof(dma_cb_t) + _capacity * sizeof(uint32_t), &_dma))
+	{
+		return false;
+	}
+
+	Provider::FifoDmaTarget target{};
+	if (!_channel->_provider->enableDma(true, &target))
+	{
+		bcm_dmaFree(&_dma);
+		return false;
+	}
+
+	/* Every block moves its segment into the FIFO a word per DREQ, the links come with the samples */
+	_blocks = reinterpret_cast<dma_cb_t*>(_dma.virt);
+	_samples = reinterpret_cast<uint32_t*>(_dma.virt + _segments * sizeof(dma_cb_t));
+	const uint32_t samples = _dma.bus + _segments * sizeof(dma_cb_t);
+	const uint32_t ti = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP | DMA_TI_DEST_DREQ | DMA_TI_PERMAP(target.dreq) | DMA_TI_SRC_INC;
+	for (std::size_t i = 0; i < _segments; ++i)
+	{
+		_blocks[i] = {ti,
+					  static_cast<uint32_t>(samples + i * segmentLength * sizeof(uint32_t)),
+					  target.busAddress,
+					  segmentLength * sizeof(uint32_t),
+					  0, 0, {}};
+	}
+	__sync_synchronize();
+
+	regs->controlStatus = DMA_CS_RESET;
+	while (regs->controlStatus & DMA_CS_RESET)
+	{
+		std::this_thread::yield();
+	}
+	bcm_dmaPerip()->ENABLE |= 1u << channel;
+
+	_dmaRegs = regs;
+	return true;
+}
+
+void PwmStream::stopDma()
+{
+	_dmaRegs->controlStatus = DMA_CS_RESET;
+	while (_dmaRegs->controlStatus & DMA_CS_RESET)
+	{
+		std::this_thread::yield();
+	}
+	_channel->_provider->enableDma(false, nullptr);
+	bcm_dmaFree(&_dma);
+}
+
+/* Appends a completed segment to the chain. The channel reads the link of a block when it
+ * starts on it, one loaded before the link was written is patched in its registers while
+ * the channel is paused, a chain that ran out is restarted */
+void PwmStream::link(std::size_t segment) noexcept
+{
+	const auto index = segment % _segments;
+	const auto previous = (segment + _segments - 1) % _segments;
+	const uint32_t address = _dma.bus + index * sizeof(dma_cb_t);
+	const uint32_t previousAddress = _dma.bus + previous * sizeof(dma_cb_t);
+
+	_blocks[index].nextCB = 0;
+	__sync_synchronize();
+	if (segment > 0)
+	{
+		_blocks[previous].nextCB = address;
+		__sync_synchronize();
+	}
+	_published.store((segment + 1) * segmentLength, std::memory_order_release);
+
+	auto regs = _dmaRegs;
+	if (segment > 0 && regs->controlBlockAddress == previousAddress)
+	{
+		regs->controlStatus = csFlags;
+		while (!(regs->controlStatus & DMA_CS_PAUSED) && regs->controlBlockAddress != 0)
+		{
+			std::this_thread::yield();
+		}
+		if (regs->controlBlockAddress != 0)
+		{
+			if (regs->nextCBAddress == 0)
+			{
+				regs->nextCBAddress = address;
+			}
+			regs->controlStatus = csFlags | DMA_CS_ACTIVE;
+			return;
+		}
+	}
+
+	if (regs->controlBlockAddress == 0)
+	{
+		/* END is write-1-to-clear */
+		regs->controlBlockAddress = address;
+		regs->controlStatus = csFlags | DMA_CS_END | DMA_CS_ACTIVE;
+		if (_started.exchange(true, std::memory_order_relaxed))
+		{
+			_underruns.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+/* First sample the DMA may still read, the start of the segment it is on */
+std::size_t PwmStream::dmaTail() const noexcept
+{
+	const auto published = _published.load(std::memory_order_acquire);
+	const uint32_t current = _dmaRegs->controlBlockAddress;
+	const auto index = static_cast<std::size_t>(current - _dma.bus) / sizeof(dma_cb_t);
+	if (current == 0 || index >= _segments)
+	{
+		/* Stopped, everything linked has played */
+		return published;
+	}
+
+	/* The DMA is on a linked segment, the last one when it is a whole ring behind */
+	const auto behind = ((published / segmentLength) % _segments + _segments - index) % _segments;
+	return published - (behind ? behind : _segments) * segmentLength;
+}
+
+std::size_t PwmStream::push(uint32_t const* samples, std::size_t count) noexcept
+{
+	const auto head = _head.load(std::memory_order_relaxed);
+	const auto tail = _dmaRegs ? dmaTail() : _tail.load(std::memory_order_acquire);
+	const auto n = std::min(count, _capacity - (head - tail));
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		_samples[(head + i) & _mask] = samples[i];
+	}
+	_head.store(head + n, std::memory_order_release);
+
+	if (_dmaRegs)
+	{
+		for (auto published = _published.load(std::memory_order_relaxed); published + segmentLength <= head + n;
+			 published += segmentLength)
+		{
+			link(published / segmentLength);
+		}
+	}
+	return n;
+}
+
+std::size_t PwmStream::write(uint32_t const* samples, std::size_t count)
+{
+	return push(samples, count);
+}
+
+void PwmStream::setRefill(Refill refill)
+{
+	std::lock_guard<std::mutex> guard(_refillLock);
+	_refill = std::move(refill);
+
+	/* With DMA the thread is only there to call the refill */
+	if (_dmaRegs && _refill && !_thread.joinable())
+	{
+		_thread = LibraryThreads::spawn(&PwmStream::runRefill, this);
+	}
+}
+
+std::size_t PwmStream::queued() const noexcept
+{
+	const auto tail = _dmaRegs ? dmaTail() : _tail.load(std::memory_order_acquire);
+	return _head.load(std::memory_order_acquire) - tail;
+}
+
+uint64_t PwmStream::played() const noexcept
+{
+	return _dmaRegs ? dmaTail() : _played.load(std::memory_order_relaxed);
+}
+
+uint64_t PwmStream::underruns() const noexcept
+{
+	const auto counted = _underruns.load(std::memory_order_relaxed);
+	if (_dmaRegs)
+	{
+		/* The dry spell going on is counted once the chain restarts */
+		const bool dry = _started.load(std::memory_order_relaxed) && _dmaRegs->controlBlockAddress == 0;
+		return counted + (dry ? 1 : 0);
+	}
+	return counted;
+}
+
+void PwmStream::refill()
+{
+	if (queued() < _capacity / 2)
+	{
+		std::unique_lock<std::mutex> guard(_refillLock, std::try_to_lock);
+		if (guard.owns_lock() && _refill)
+		{
+			const auto free = _capacity - queued();
+			push(_scratch.data(), _refill(_scratch.data(), std::min(free, _scratch.size())));
+		}
+	}
+}
+
+void PwmStream::runRefill()
+{
+	/* A quarter of the ring plays between two looks at it */
+	const auto interval = std::chrono::duration<double>(_capacity / 4 / _sampleRate);
+	while (_running.load(std::memory_order_relaxed))
+	{
+		refill();
+		std::this_thread::sleep_for(interval);
+	}
+}
+
+void PwmStream::run()
+{
+	using clock = std::chrono::steady_clock;
+
+	auto provider = _channel->_provider.get();
+	const auto interval = std::chrono::duration_cast<clock::duration>(
+		std::chrono::duration<double>(fifoDepth / 2 / _sampleRate));
+
+	/* Samples the FIFO may hold at most, by the time elapsed since the last top up */
+	auto last = clock::now();
+	double inFifo = 0.0;
+	bool dry = false;
+
+	while (_running.load(std::memory_order_relaxed))
+	{
+		const auto now = clock::now();
+		inFifo = std::max(0.0, inFifo - std::chrono::duration<double>(now - last).count() * _sampleRate);
+		last = now;
+
+		refill();
+
+		/* Contiguous part of the ring first, the wrapped part on the next round */
+		auto tail = _tail.load(std::memory_order_relaxed);
+		const auto available = _head.load(std::memory_order_acquire) - tail;
+		const auto room = fifoDepth - static_cast<std::size_t>(std::ceil(inFifo));
+		const auto count = std::min({available, room, _capacity - (tail & _mask)});
+
+		const auto written = count ? provider->writeFifo(&_samples[tail & _mask], count) : 0;
+		_tail.store(tail + written, std::memory_order_release);
+		_played.fetch_add(written, std::memory_order_relaxed);
+		inFifo += written;
+
+		/* Once per dry spell, whoever noticed it first */
+		const bool gap = provider->fifoGap() || (available == 0 && inFifo < 1.0 && _played.load(std::memory_order_relaxed));
+		if (gap && !dry)
+		{
+			_underruns.fetch_add(1, std::memory_order_relaxed);
+		}
+		dry = gap;
+
+		std::this_thread::sleep_until(now + interval);
+	}
+}
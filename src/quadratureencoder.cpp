@@ -0,0 +1,126 @@
+#include "devices/quadratureencoder.hpp"
+#include "exceptions.hpp"
+
+#include <cmath>
+
+using namespace Devices;
+using namespace Devices::Gpio;
+
+/* Count change for previous state << 2 | new state, both being A << 1 | B. 2 flags a
+ * transition where both channels changed */
+static constexpr int8_t transitions[16] = {
+	 0, -1, +1,  2,
+	+1,  0,  2, -1,
+	-1,  2,  0, +1,
+	 2, +1, -1,  0
+};
+
+static uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+QuadratureEncoder::QuadratureEncoder(std::shared_ptr<GpioPin> a, std::shared_ptr<GpioPin> b, std::chrono::microseconds window) :
+	_a(std::move(a)), _b(std::move(b)),
+	_window(std::chrono::duration_cast<std::chrono::nanoseconds>(window).count())
+{
+	if (!_a || !_b || _a == _b)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::QuadratureEncoder::QuadratureEncoder()",
+											  "two distinct pins",
+											  "the same pin or none");
+	}
+	if (_a->_direct || _b->_direct)
+	{
+		/* The line is read by the caller's event loop, it cannot be shared */
+		throw LLD::not_supported_exception{};
+	}
+
+	_state = (_a->read() == PinValue::High ? 2u : 0u) | (_b->read() == PinValue::High ? 1u : 0u);
+
+	const auto bitA = _a->pinNumber();
+	const auto bitB = _b->pinNumber();
+	auto decode = [this, bitA, bitB](uint64_t levels, uint64_t timestamp) {
+		update(static_cast<unsigned>((levels >> bitA) & 1) << 1 | static_cast<unsigned>((levels >> bitB) & 1), timestamp);
+	};
+
+	if (_a->_provider->enableLevelInterrupt(decode))
+	{
+		if (_b->_provider->enableLevelInterrupt(decode))
+		{
+			return;
+		}
+		_a->_provider->enableInterrupt(PinEdge::None, nullptr);
+	}
+
+	/* Levels one by one, each edge only moves its own channel */
+	_a->_provider->enableInterrupt(PinEdge::Both, [this](GpioEvent const& event) {
+		update((_state & 1u) | (event.edge == PinEdge::Rising ? 2u : 0u), event.timestamp);
+	});
+	_b->_provider->enableInterrupt(PinEdge::Both, [this](GpioEvent const& event) {
+		update((_state & 2u) | (event.edge == PinEdge::Rising ? 1u : 0u), event.timestamp);
+	});
+}
+
+QuadratureEncoder::~QuadratureEncoder()
+{
+	/* Hand the pins back to their own consumers, if any */
+	_a->rearm();
+	_b->rearm();
+}
+
+double QuadratureEncoder::velocity() const noexcept
+{
+	const auto velocity = _velocity.load(std::memory_order_relaxed);
+	const auto last = _lastEdgeSeen.load(std::memory_order_relaxed);
+	if (!last)
+	{
+		return 0.0;
+	}
+
+	/* No faster than one count over the time since the last edge */
+	const auto elapsed = now() - last;
+	if (elapsed > 0 && std::fabs(velocity) * elapsed > 1e9)
+	{
+		return std::copysign(1e9 / elapsed, velocity);
+	}
+	return velocity;
+}
+
+void QuadratureEncoder::update(unsigned state, uint64_t timestamp)
+{
+	/* Both channels of a pin pair fire in the same poll, the second one sees no change */
+	if (state == _state)
+	{
+		return;
+	}
+
+	const auto delta = transitions[_state << 2 | state];
+	_state = state;
+	if (delta == 2)
+	{
+		_errors.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	_counts += delta;
+	_position.fetch_add(delta, std::memory_order_relaxed);
+
+	if (!_lastEdge || timestamp - _lastEdge > _window)
+	{
+		/* Starting to turn, one count over the time it took is all there is to go by */
+		_velocity.store(_lastEdge ? delta * 1e9 / (timestamp - _lastEdge) : 0.0, std::memory_order_relaxed);
+		_windowStart = timestamp;
+		_windowCounts = _counts;
+	}
+	else if (timestamp - _windowStart >= _window)
+	{
+		_velocity.store((_counts - _windowCounts) * 1e9 / (timestamp - _windowStart), std::memory_order_relaxed);
+		_windowStart = timestamp;
+		_windowCounts = _counts;
+	}
+
+	_lastEdge = timestamp;
+	_lastEdgeSeen.store(timestamp, std::memory_order_relaxed);
+}
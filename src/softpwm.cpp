@@ -0,0 +1,250 @@
+#include "devices/softpwm.hpp"
+#include "exceptions.hpp"
+#include "threadpolicy.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace Devices;
+using namespace Devices::Gpio;
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+/* Sleeping is only worth it this far ahead of the next edge, closer than that the thread spins */
+static constexpr uint64_t sleepThreshold = 200000;
+
+static uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, timespec const* timeout)
+{
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr,
+				   FUTEX_BITSET_MATCH_ANY);
+}
+
+SoftPwm::SoftPwm(std::shared_ptr<GpioPort> port, std::chrono::nanoseconds resolution) :
+	_port(std::move(port)), _resolution(std::max<int64_t>(resolution.count(), 0))
+{
+	if (!_port || _port->width() == 0)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::SoftPwm::SoftPwm()",
+											  "a port of at least one pin",
+											  "none");
+	}
+
+	_channels.resize(_port->width());
+	_schedule.reserve(_channels.size());
+	_batch.reserve(_channels.size());
+
+	_port->setDriveMode(PinDriveMode::Output);
+	_port->write(~uint64_t{0}, 0);
+
+	_thread = LibraryThreads::spawn(&SoftPwm::run, this);
+}
+
+SoftPwm::~SoftPwm()
+{
+	_running = false;
+	_posted.fetch_add(1);
+	futex(&_posted, FUTEX_WAKE_PRIVATE, 1, nullptr);
+	_thread.join();
+
+	_port->write(~uint64_t{0}, 0);
+}
+
+void SoftPwm::setPulse(std::size_t channel, std::chrono::nanoseconds period, std::chrono::nanoseconds high)
+{
+	if (channel >= _channels.size())
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::SoftPwm::setPulse()",
+											  "channel < " + std::to_string(_channels.size()),
+											  std::to_string(channel));
+	}
+	if (period.count() < 0 || period.count() > UINT32_MAX)
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::SoftPwm::setPulse()",
+											  "0 <= period <= 4294967295ns",
+											  std::to_string(period.count()));
+	}
+
+	const auto highNs = std::clamp<int64_t>(high.count(), 0, period.count());
+	const auto previous = _settings[channel].exchange(uint64_t(period.count()) << 32 | uint64_t(highNs));
+
+	/* A running channel picks it up at its next period, one that was off needs the thread.
+	 * Sequentially consistent with the thread going to sleep, see wait() */
+	if ((previous >> 32) == 0 && period.count() != 0)
+	{
+		_posted.fetch_add(1);
+		if (_sleeping.load())
+		{
+			futex(&_posted, FUTEX_WAKE_PRIVATE, 1, nullptr);
+		}
+	}
+}
+
+void SoftPwm::set(std::size_t channel, double frequency, double dutyCycle)
+{
+	if (!(frequency >= 0.0) || !(dutyCycle >= 0.0 && dutyCycle <= 1.0))
+	{
+		throw LLD::invalid_argument_exception("Devices::Gpio::SoftPwm::set()",
+											  "frequency >= 0 and 0 <= duty cycle <= 1",
+											  std::to_string(frequency) + ", " + std::to_string(dutyCycle));
+	}
+
+	const auto period = frequency > 0.0 ? std::llround(1e9 / frequency) : 0;
+	setPulse(channel, std::chrono::nanoseconds{period}, std::chrono::nanoseconds{std::llround(period * dutyCycle)});
+}
+
+void SoftPwm::schedule(std::size_t channel, uint64_t time)
+{
+	/* Few entries, kept sorted by insertion from the back */
+	auto at = _schedule.end();
+	while (at != _schedule.begin() && std::prev(at)->time > time)
+	{
+		--at;
+	}
+	_schedule.insert(at, edge_t{time, channel});
+}
+
+void SoftPwm::edge(std::size_t channel, uint64_t time, uint64_t now, uint64_t& value)
+{
+	auto& ch = _channels[channel];
+	const auto bit = uint64_t{1} << channel;
+
+	if (!ch.rising)
+	{
+		value &= ~bit;
+		ch.rising = true;
+		schedule(channel, ch.start + ch.period);
+		return;
+	}
+
+	/* Period boundary, the only place settings change */
+	const auto settings = _settings[channel].load(std::memory_order_relaxed);
+	ch.period = static_cast<uint32_t>(settings >> 32);
+	ch.high = static_cast<uint32_t>(settings);
+
+	/* Stalled for a whole period or more, start afresh instead of catching up */
+	ch.start = ch.period && now > time + ch.period ? now : time;
+
+	if (ch.period == 0 || ch.high == 0)
+	{
+		value &= ~bit;
+	}
+	else
+	{
+		value |= bit;
+	}
+
+	if (ch.period == 0)
+	{
+		return;
+	}
+	if (ch.high == 0 || ch.high == ch.period)
+	{
+		schedule(channel, ch.start + ch.period);
+	}
+	else
+	{
+		ch.rising = false;
+		schedule(channel, ch.start + ch.high);
+	}
+}
+
+void SoftPwm::wait(uint32_t posted, uint64_t until)
+{
+	/* A channel turned on after the snapshot either sees _sleeping or changes the futex word */
+	_sleeping.store(true);
+	if (until)
+	{
+		const timespec deadline{static_cast<time_t>(until / 1000000000), static_cast<long>(until % 1000000000)};
+		futex(&_posted, FUTEX_WAIT_BITSET_PRIVATE, posted, &deadline);
+	}
+	else
+	{
+		futex(&_posted, FUTEX_WAIT_BITSET_PRIVATE, posted, nullptr);
+	}
+	_sleeping.store(false);
+}
+
+void SoftPwm::run()
+{
+	uint64_t value = 0;
+	/* Initial value of _posted, channels turned on before the thread got here are seen too */
+	uint32_t seen = 0;
+	while (_running.load(std::memory_order_relaxed))
+	{
+		const auto posted = _posted.load();
+		if (posted != seen)
+		{
+			seen = posted;
+
+			/* Channels turned on start their first period right away */
+			const auto start = ::now();
+			for (std::size_t channel = 0; channel < _channels.size(); ++channel)
+			{
+				const auto scheduled = std::any_of(_schedule.begin(), _schedule.end(),
+												   [channel](auto const& e){ return e.channel == channel; });
+				if (!scheduled && (_settings[channel].load() >> 32))
+				{
+					_channels[channel].rising = true;
+					schedule(channel, start);
+				}
+			}
+		}
+
+		if (_schedule.empty())
+		{
+			wait(posted, 0);
+			continue;
+		}
+
+		const auto due = _schedule.front().time;
+		auto t = ::now();
+		if (due > t + sleepThreshold)
+		{
+			wait(posted, due - sleepThreshold / 2);
+			continue;
+		}
+		while (t < due)
+		{
+			cpuRelax();
+			t = ::now();
+		}
+
+		/* Every edge due within the resolution goes out with this write */
+		uint64_t mask = 0;
+		std::size_t taken = 0;
+		while (taken < _schedule.size() && _schedule[taken].time <= t + _resolution)
+		{
+			++taken;
+		}
+
+		_batch.assign(_schedule.begin(), _schedule.begin() + taken);
+		_schedule.erase(_schedule.begin(), _schedule.begin() + taken);
+		for (auto const& e : _batch)
+		{
+			if (t > e.time + _resolution)
+			{
+				_late.fetch_add(1, std::memory_order_relaxed);
+			}
+			mask |= uint64_t{1} << e.channel;
+			edge(e.channel, e.time, t, value);
+		}
+
+		_port->write(mask, value);
+	}
+}
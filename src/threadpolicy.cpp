@@ -0,0 +1,184 @@
+#include "threadpolicy.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <alloca.h>
+#include <cerrno>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+using namespace Devices;
+
+static std::mutex registryLock;
+static std::vector<pthread_t> registry;
+static ThreadPolicy currentPolicy;
+
+static int schedPolicy(ThreadPolicy::Scheduler scheduler)
+{
+	switch (scheduler)
+	{
+	case ThreadPolicy::Scheduler::Fifo:
+		return SCHED_FIFO;
+	case ThreadPolicy::Scheduler::RoundRobin:
+		return SCHED_RR;
+	default:
+		return SCHED_OTHER;
+	}
+}
+
+/* Returns 0 or the errno of the failed call, op names it. A thread just started only gets the
+ * settings that differ from what it inherited from the process */
+static int apply(pthread_t thread, ThreadPolicy const& policy, bool started, const char*& op)
+{
+	if (!started || policy.scheduler != ThreadPolicy::Scheduler::Other)
+	{
+		sched_param param{};
+		param.sched_priority = policy.scheduler == ThreadPolicy::Scheduler::Other ? 0 : policy.priority;
+
+		op = "pthread_setschedparam";
+		if (auto err = pthread_setschedparam(thread, schedPolicy(policy.scheduler), &param))
+		{
+			return err;
+		}
+	}
+
+	if (started && policy.cpus.empty())
+	{
+		return 0;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (policy.cpus.empty())
+	{
+		/* Back to the affinity of the caller, normally the one of the process */
+		op = "sched_getaffinity";
+		if (sched_getaffinity(0, sizeof set, &set) < 0)
+		{
+			return errno;
+		}
+	}
+	for (auto cpu : policy.cpus)
+	{
+		CPU_SET(cpu, &set);
+	}
+
+	op = "pthread_setaffinity_np";
+	return pthread_setaffinity_np(thread, sizeof set, &set);
+}
+
+/* Stack left to the thread below the prefaulted part */
+static constexpr std::size_t stackMargin = 64 * 1024;
+
+/* Stack size every library thread gets, std::thread goes with the default attributes */
+static std::size_t threadStackSize()
+{
+	pthread_attr_t attr;
+	std::size_t size = 0;
+	if (pthread_getattr_default_np(&attr) == 0)
+	{
+		pthread_attr_getstacksize(&attr, &size);
+		pthread_attr_destroy(&attr);
+	}
+	return size;
+}
+
+static void __attribute__((noinline)) prefaultStack(std::size_t bytes)
+{
+	auto stack = static_cast<volatile char*>(alloca(bytes));
+	for (std::size_t i = 0; i < bytes; i += 4096)
+	{
+		stack[i] = 0;
+	}
+}
+
+// --------------------------------------------------------------------------------------
+
+/* static */ void LibraryThreads::setPolicy(ThreadPolicy const& policy)
+{
+	const auto sched = schedPolicy(policy.scheduler);
+	if (policy.scheduler != ThreadPolicy::Scheduler::Other &&
+		(policy.priority < sched_get_priority_min(sched) || policy.priority > sched_get_priority_max(sched)))
+	{
+		throw LLD::invalid_argument_exception("Devices::LibraryThreads::setPolicy()",
+											  "priority within sched_get_priority_min/max",
+											  std::to_string(policy.priority));
+	}
+	if (policy.stackPrefault)
+	{
+		const auto stack = threadStackSize();
+		if (stack <= stackMargin || policy.stackPrefault > stack - stackMargin)
+		{
+			throw LLD::invalid_argument_exception("Devices::LibraryThreads::setPolicy()",
+												  "stackPrefault <= thread stack size - " + std::to_string(stackMargin) +
+												  " (" + std::to_string(stack) + ")",
+												  std::to_string(policy.stackPrefault));
+		}
+	}
+	for (auto cpu : policy.cpus)
+	{
+		if (cpu < 0 || cpu >= CPU_SETSIZE)
+		{
+			throw LLD::invalid_argument_exception("Devices::LibraryThreads::setPolicy()",
+												  "0 <= cpu < CPU_SETSIZE",
+												  std::to_string(cpu));
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(registryLock);
+
+	if (policy.lockMemory != currentPolicy.lockMemory)
+	{
+		if (policy.lockMemory ? mlockall(MCL_CURRENT | MCL_FUTURE) : munlockall())
+		{
+			throw LLD::thread_policy_exception(errno, policy.lockMemory ? "mlockall" : "munlockall");
+		}
+	}
+
+	/* Running threads may be left with part of the policy if it fails midway */
+	for (auto thread : registry)
+	{
+		const char* op;
+		if (auto err = apply(thread, policy, false, op))
+		{
+			currentPolicy.lockMemory = policy.lockMemory;
+			throw LLD::thread_policy_exception(err, op);
+		}
+	}
+
+	currentPolicy = policy;
+}
+
+/* static */ ThreadPolicy LibraryThreads::getPolicy()
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	return currentPolicy;
+}
+
+LibraryThreads::registration_t::registration_t()
+{
+	std::size_t prefault;
+	{
+		std::lock_guard<std::mutex> guard(registryLock);
+		registry.push_back(pthread_self());
+
+		/* The policy was applied successfully to running threads already, a failure here
+		 * can only be a lack of privileges nobody can be told about */
+		const char* op;
+		[[maybe_unused]] auto err = apply(pthread_self(), currentPolicy, true, op);
+		prefault = currentPolicy.stackPrefault;
+	}
+
+	if (prefault)
+	{
+		prefaultStack(prefault);
+	}
+}
+
+LibraryThreads::registration_t::~registration_t()
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	registry.erase(std::find(registry.begin(), registry.end(), pthread_self()));
+}
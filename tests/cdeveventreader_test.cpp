@@ -0,0 +1,168 @@
+#include "cdevgpioprovider.hpp"
+#include "check.hpp"
+#include "fakelineeventfd.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace Devices::Gpio::Provider;
+using namespace std::chrono_literals;
+
+/* Records arrive whole, in order and with their timestamps, across several batches */
+static void replaysRecordedEvents()
+{
+	CDevEventReader reader;
+	FakeLineEventFd line;
+
+	std::mutex lock;
+	std::vector<gpio_v2_line_event> seen;
+	reader.add(line.fd(), [&](gpio_v2_line_event const& event) {
+		std::lock_guard<std::mutex> guard(lock);
+		seen.push_back(event);
+	});
+
+	constexpr uint32_t count = 3 * CDevEventReader::batchSize + 5;
+	std::vector<gpio_v2_line_event> recorded;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		recorded.push_back(FakeLineEventFd::record(1000000 + i * 250, i % 2 == 0, 17, i + 1));
+	}
+	line.replay(recorded.data(), recorded.size());
+
+	CHECK(waitFor([&]{ std::lock_guard<std::mutex> guard(lock); return seen.size() == count; }));
+	reader.remove(line.fd());
+
+	std::lock_guard<std::mutex> guard(lock);
+	CHECK(seen.size() == count);
+	for (std::size_t i = 0; i < seen.size() && i < count; ++i)
+	{
+		CHECK(seen[i].seqno == recorded[i].seqno);
+		CHECK(seen[i].timestamp_ns == recorded[i].timestamp_ns);
+		CHECK(seen[i].id == recorded[i].id);
+		CHECK(seen[i].offset == 17);
+	}
+}
+
+/* Once remove() returns the handler is never called again, even with a batch in flight */
+static void removeWaitsForDispatch()
+{
+	CDevEventReader reader;
+	std::atomic<int> late{0};
+	std::atomic<int> calls{0};
+
+	for (int round = 0; round < 200; ++round)
+	{
+		FakeLineEventFd line;
+		std::atomic_bool owned{true};
+		reader.add(line.fd(), [&](gpio_v2_line_event const&) {
+			++calls;
+			/* Widen the window between epoll_wait() and the dispatch */
+			std::this_thread::sleep_for(20us);
+			if (!owned)
+			{
+				++late;
+			}
+		});
+
+		std::vector<gpio_v2_line_event> burst(8, FakeLineEventFd::record(0, true, 4, 1));
+		line.replay(burst.data(), burst.size());
+		if (round % 2)
+		{
+			std::this_thread::sleep_for(10us * (round % 7));
+		}
+
+		reader.remove(line.fd());
+		owned = false;
+		line.closeRead();
+		/* Anything still running on the stale handler would show up now */
+		std::this_thread::sleep_for(50us);
+	}
+
+	CHECK(calls > 0);
+	CHECK(late == 0);
+}
+
+/* A handler removed while its fd sits in the batch being dispatched is skipped */
+static void removeSkipsPendingDispatch()
+{
+	CDevEventReader reader;
+	FakeLineEventFd gate, first, second;
+	auto event = FakeLineEventFd::record(0, true, 4, 1);
+
+	/* Hold the reader until both lines have an event pending, one epoll_wait() returns both */
+	std::atomic_bool open{false};
+	reader.add(gate.fd(), [&](gpio_v2_line_event const&) {
+		while (!open)
+		{
+			std::this_thread::sleep_for(100us);
+		}
+	});
+	gate.replay(&event, 1);
+
+	std::atomic<int> running{-1};
+	std::atomic<int> calls[2]{};
+	auto handler = [&](int line) {
+		return [&, line](gpio_v2_line_event const&) {
+			++calls[line];
+			int idle = -1;
+			if (running.compare_exchange_strong(idle, line))
+			{
+				std::this_thread::sleep_for(20ms);
+			}
+		};
+	};
+	reader.add(first.fd(), handler(0));
+	reader.add(second.fd(), handler(1));
+	first.replay(&event, 1);
+	second.replay(&event, 1);
+	open = true;
+
+	CHECK(waitFor([&]{ return running >= 0; }));
+	const int other = 1 - running;
+	reader.remove(other ? second.fd() : first.fd());
+	CHECK(calls[other] == 0);
+
+	reader.remove(gate.fd());
+	reader.remove(first.fd());
+	reader.remove(second.fd());
+}
+
+/* A handler can remove itself, the rest of its batch is dropped */
+static void removeFromHandler()
+{
+	CDevEventReader reader;
+	FakeLineEventFd line;
+
+	std::atomic<int> calls{0};
+	const int fd = line.fd();
+	reader.add(fd, [&](gpio_v2_line_event const&) {
+		++calls;
+		reader.remove(fd);
+	});
+
+	std::vector<gpio_v2_line_event> burst(10, FakeLineEventFd::record(0, false, 4, 1));
+	line.replay(burst.data(), burst.size());
+
+	CHECK(waitFor([&]{ return calls > 0; }));
+	std::this_thread::sleep_for(20ms);
+	CHECK(calls == 1);
+}
+
+int main()
+{
+	replaysRecordedEvents();
+	removeWaitsForDispatch();
+	removeSkipsPendingDispatch();
+	removeFromHandler();
+
+	if (failures)
+	{
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
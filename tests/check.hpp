@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+/**
+ *  Minimal checks shared by the tests
+ *
+ *  A failed CHECK() is reported and counted, the test carries on and main() returns
+ *  non-zero when failures is set. waitFor() polls a condition set by another thread.
+ */
+static int failures = 0;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if (!(cond)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			++failures; \
+		} \
+	} while (false)
+
+template<typename Pred>
+static bool waitFor(Pred pred, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000))
+{
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (!pred())
+	{
+		if (std::chrono::steady_clock::now() > deadline)
+		{
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+	return true;
+}
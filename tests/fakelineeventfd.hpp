@@ -0,0 +1,82 @@
+#pragma once
+
+#include <linux/gpio.h>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+/**
+ *  Stand-in for the fd of a GPIO v2 line request
+ *
+ *  A pipe, the read end goes to CDevEventReader::add() and replay() writes recorded
+ *  gpio_v2_line_event records to the other one. Writes up to PIPE_BUF are atomic, so the
+ *  reader only ever sees whole records, like from the kernel.
+ */
+class FakeLineEventFd
+{
+public:
+	FakeLineEventFd()
+	{
+		int fds[2];
+		if (pipe2(fds, O_CLOEXEC) < 0)
+		{
+			throw std::runtime_error("pipe2");
+		}
+		_read = fds[0];
+		_write = fds[1];
+	}
+	~FakeLineEventFd()
+	{
+		closeRead();
+		::close(_write);
+	}
+
+	FakeLineEventFd(FakeLineEventFd const&) = delete;
+	FakeLineEventFd& operator=(FakeLineEventFd const&) = delete;
+
+	[[nodiscard]] int fd() const noexcept { return _read; }
+
+	/* What the owner of a line request does once it is done with it */
+	void closeRead() noexcept
+	{
+		if (_read >= 0)
+		{
+			::close(_read);
+			_read = -1;
+		}
+	}
+
+	void replay(gpio_v2_line_event const* events, std::size_t count)
+	{
+		while (count)
+		{
+			const auto n = count < maxBurst ? count : maxBurst;
+			if (::write(_write, events, n * sizeof *events) != static_cast<ssize_t>(n * sizeof *events))
+			{
+				throw std::runtime_error("write");
+			}
+			events += n;
+			count -= n;
+		}
+	}
+
+	static gpio_v2_line_event record(uint64_t timestamp, bool rising, uint32_t offset, uint32_t seqno)
+	{
+		gpio_v2_line_event event{};
+		event.timestamp_ns = timestamp;
+		event.id = rising ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+		event.offset = offset;
+		event.seqno = seqno;
+		event.line_seqno = seqno;
+		return event;
+	}
+
+private:
+	static constexpr std::size_t maxBurst = PIPE_BUF / sizeof(gpio_v2_line_event);
+
+	int _read;
+	int _write;
+};
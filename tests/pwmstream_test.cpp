@@ -0,0 +1,174 @@
+#include "bcm_sim.hpp"
+#include "clock.hpp"
+#include "exceptions.hpp"
+#include "devices/ledstrip.hpp"
+#include "devices/pwm.hpp"
+#include "devices/pwmstream.hpp"
+#include "check.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace Devices::Pwm;
+using namespace std::chrono_literals;
+
+/* 1MHz from the 54MHz oscillator of the simulated BCM2711, 10k samples per second */
+static std::shared_ptr<PwmChannel> openChannel()
+{
+	Clocks::ClockManager::SetPWMClock(Clocks::ClockSource::Oscillator, 54, 0);
+	auto channel = PwmController::getDefault()->open(0);
+	channel->setRange(100);
+	return channel;
+}
+
+static std::vector<uint32_t> ramp(std::size_t count, uint32_t first = 0)
+{
+	std::vector<uint32_t> samples(count);
+	std::iota(samples.begin(), samples.end(), first);
+	return samples;
+}
+
+/* Every sample reaches the FIFO through the control blocks, the chain running out is one underrun */
+static void dmaPlaysEverySample()
+{
+	auto sim = bcm_simulator();
+	PwmStream stream(openChannel(), 10000.0, 1024);
+	CHECK(stream.dma());
+
+	const auto words = sim->pwmWords(0);
+	const auto samples = ramp(10 * PwmStream::segmentLength, 1);
+	CHECK(stream.write(samples.data(), samples.size()) == samples.size());
+
+	CHECK(waitFor([&]{ return sim->pwmWords(0) - words == samples.size(); }));
+	CHECK(stream.played() == samples.size());
+	CHECK(stream.queued() == 0);
+	CHECK(bcm_pwmPerip(0)->CHANNEL[0].FIF == samples.back());
+	CHECK(stream.underruns() == 1);
+
+	/* Restarts on the next segment, the dry spell stays counted once */
+	CHECK(stream.write(samples.data(), PwmStream::segmentLength) == PwmStream::segmentLength);
+	CHECK(waitFor([&]{ return stream.played() == samples.size() + PwmStream::segmentLength; }));
+	CHECK(waitFor([&]{ return sim->pwmWords(0) - words == samples.size() + PwmStream::segmentLength; }));
+	CHECK(stream.underruns() == 2);
+}
+
+/* A partial segment is held back until it completes */
+static void dmaHoldsPartialSegment()
+{
+	auto sim = bcm_simulator();
+	PwmStream stream(openChannel(), 10000.0, 1024);
+
+	const auto words = sim->pwmWords(0);
+	const auto samples = ramp(PwmStream::segmentLength + 10);
+	stream.write(samples.data(), samples.size());
+
+	CHECK(waitFor([&]{ return stream.played() == PwmStream::segmentLength; }));
+	std::this_thread::sleep_for(20ms);
+	CHECK(sim->pwmWords(0) - words == PwmStream::segmentLength);
+	CHECK(stream.queued() == 10);
+
+	const auto rest = ramp(PwmStream::segmentLength - 10);
+	stream.write(rest.data(), rest.size());
+	CHECK(waitFor([&]{ return sim->pwmWords(0) - words == 2 * PwmStream::segmentLength; }));
+	CHECK(stream.queued() == 0);
+}
+
+/* The ring never takes more than it holds, the DMA frees it a segment at a time */
+static void dmaBoundsTheRing()
+{
+	PwmStream stream(openChannel(), 10000.0, 256);
+	const auto samples = ramp(1024);
+
+	CHECK(stream.write(samples.data(), samples.size()) == stream.capacity());
+	CHECK(waitFor([&]{ return stream.queued() <= stream.capacity() - PwmStream::segmentLength; }));
+	CHECK(stream.write(samples.data(), samples.size()) >= PwmStream::segmentLength);
+}
+
+/* The refill callback keeps a DMA stream going without underruns */
+static void dmaRefillKeepsUp()
+{
+	PwmStream stream(openChannel(), 10000.0, 1024);
+
+	uint32_t next = 0;
+	stream.setRefill([&](uint32_t* samples, std::size_t count) {
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			samples[i] = next++ % 100;
+		}
+		return count;
+	});
+
+	CHECK(waitFor([&]{ return stream.played() >= 3000; }));
+	CHECK(stream.underruns() == 0);
+}
+
+/* Without a DMA channel the thread feeds the FIFO */
+static void threadFallback()
+{
+	PwmStream stream(openChannel(), 10000.0, 1024, -1);
+	CHECK(!stream.dma());
+
+	const auto samples = ramp(500);
+	CHECK(stream.write(samples.data(), samples.size()) == samples.size());
+	CHECK(waitFor([&]{ return stream.played() == samples.size(); }));
+}
+
+/* The strip refuses to run from the thread, which cannot keep up with 800kHz */
+static void ledStripNeedsDma()
+{
+	auto channel = openChannel();
+	LedStrip::takeClock();
+
+	bool refused = false;
+	try
+	{
+		LedStrip strip(channel, 10, -1);
+	}
+	catch (LLD::not_supported_exception const&)
+	{
+		refused = true;
+	}
+	CHECK(refused);
+
+	LedStrip strip(channel, 10);
+	CHECK(strip.size() == 10);
+}
+
+/* Changing the clock leaves CTL as the provider's shadow has it, even if the register was reset */
+static void clockKeepsCtl()
+{
+	auto channel = openChannel();
+	channel->setPolarity(Polarity::ActiveLow);
+	channel->enable(true);
+
+	bcm_pwmPerip(0)->CTL = 0;
+	Clocks::ClockManager::SetPWMClock(Clocks::ClockSource::Oscillator, 54, 0);
+	const uint32_t ctl = bcm_pwmPerip(0)->CTL;
+	CHECK((ctl & PWM_CTL_POLA1) != 0);
+	CHECK((ctl & PWM_CTL_PWEN1) != 0);
+
+	channel->setPolarity(Polarity::ActiveHigh);
+}
+
+int main()
+{
+	bcm_setBackend(bcm_backend::Simulated);
+
+	dmaPlaysEverySample();
+	dmaHoldsPartialSegment();
+	dmaBoundsTheRing();
+	dmaRefillKeepsUp();
+	threadFallback();
+	ledStripNeedsDma();
+	clockKeepsCtl();
+
+	if (failures)
+	{
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}